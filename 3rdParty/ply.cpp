@@ -147,7 +147,6 @@ WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
     return old_id;
 */
   // };
-  double LAmag,LAsum; int LAi,LAj,LAk;
 #define VEC3_ZERO(a)	       { a[0]=a[1]=a[2]=0; }
 #define VEC3_NEG(a,b)           { a[0]= -b[0]; a[1]= -b[1];a[2]= -b[2];}
 #define VEC3_V_OP_V(a,b,op,c)  { a[0] = b[0] op c[0]; \
@@ -237,30 +236,6 @@ WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
     FACE_BLUE
   };
 
-  /*** the PLY object ***/
-
-  // static int nverts,nfaces;
-  // static Vertex **vlist;
-  // static Face **flist;
-  static PlyOtherElems *other_elements = nullptr;
-  static PlyOtherProp *vert_other,*face_other;//,*edge_other;
-  static int nelems;
-  static char **element_list;
-  static int num_comments;
-  static char **comments;
-  static int num_obj_info;
-  static char **obj_info;
-  static int file_type;
-
-  int has_x, has_y, has_z;
-  int has_face_red=0; // face colors
-  int has_face_green=0; // face colors
-  int has_face_blue=0; // face colors
-  int has_vertex_red=0; // vertex colors
-  int has_vertex_green=0; // vertex colors
-  int has_vertex_blue=0; // vertex colors
-  int has_nx=0, has_ny=0, has_nz=0;
-  int has_fverts=0;
 
 #define PRINTPROP(o,var,prop,val,str,vals)                  \
   if (vals) o << ",";                                       \
@@ -691,6 +666,7 @@ WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <stdexcept>
   // #include <ply.h>
 
 extern "C" {
@@ -717,8 +693,10 @@ extern "C" {
   } endian_test_type;
 
 
-  static int native_binary_type = -1;
-  static int types_checked = 0;
+  int get_native_binary_type();
+  /* determined once, at load time, so there's no state to change
+     (and race on) while reading files */
+  static const int native_binary_type = get_native_binary_type();
 
 #define NO_OTHER_PROPS  -1
 
@@ -780,7 +758,7 @@ extern "C" {
   void *my_alloc(int, int, const char *);
 
   /* byte ordering */
-  void get_native_binary_type();
+
   void swap_bytes(char *, int);
 
   void check_types();
@@ -818,10 +796,7 @@ Exit:
     if (fp == nullptr)
       return (nullptr);
 
-    if (native_binary_type == -1)
-      get_native_binary_type();
-    if (!types_checked)
-      check_types();
+    check_types();
   
     /* create a record for this object */
 
@@ -1383,10 +1358,7 @@ Exit:
     if (fp == nullptr)
       return (nullptr);
 
-    if (native_binary_type == -1)
-      get_native_binary_type();
-    if (!types_checked)
-      check_types();
+    check_types();
   
     /* create record for this object */
 
@@ -2434,27 +2406,22 @@ Entry:
   Find out if this machine is big endian or little endian
 
   Exit:
-    set global variable, native_binary_type =
-                              either PLY_BINARY_BE or PLY_BINARY_LE
+    returns either PLY_BINARY_BE or PLY_BINARY_LE
 
   ******************************************************************************/
 
-  void get_native_binary_type()
+  int get_native_binary_type()
   {
     endian_test_type test;
 
     test.int_value = 0;
     test.int_value = 1;
     if (test.byte_values[0] == 1)
-      native_binary_type = PLY_BINARY_LE;
+      return PLY_BINARY_LE;
     else if (test.byte_values[sizeof(int)-1] == 1)
-      native_binary_type = PLY_BINARY_BE;
+      return PLY_BINARY_BE;
     else
-      {
-        fprintf(stderr, "ply: Couldn't determine machine endianness.\n");
-        fprintf(stderr, "ply: Exiting...\n");
-        exit(1);
-      }
+      throw std::runtime_error("ply: couldn't determine machine endianness");
   }
 
   /******************************************************************************
@@ -2474,12 +2441,8 @@ Entry:
         (ply_type_size[PLY_FLOAT] != sizeof(float)) ||	
         (ply_type_size[PLY_DOUBLE] != sizeof(double)))
       {
-        fprintf(stderr, "ply: Type sizes do not match built-in types\n");
-        fprintf(stderr, "ply: Exiting...\n");
-        exit(1);
+        throw std::runtime_error("ply: type sizes do not match built-in types");
       }
-    
-    types_checked = 1;
   }
 
   /******************************************************************************
@@ -2500,8 +2463,11 @@ Exit:
   char **get_words(FILE *fp, int *nwords, char **orig_line)
   {
 #define BIG_STRING 4096
-    static char str[BIG_STRING];
-    static char str_copy[BIG_STRING];
+    /* the returned words point into 'str', so it has to outlive
+       this call; make it per thread so threads can read different
+       files concurrently */
+    static thread_local char str[BIG_STRING];
+    static thread_local char str_copy[BIG_STRING];
     char **words;
     int max_words = 10;
     int num_words = 0;
@@ -2705,8 +2671,7 @@ Entry:
   
     if (fwrite (value, ply_type_size[type], 1, fp) != 1)
       {
-        fprintf(stderr, "PLY ERROR: fwrite() failed -- aborting.\n");
-        exit(1);
+        throw std::runtime_error("ply: fwrite() failed");
       }
   }
 
@@ -2736,8 +2701,7 @@ Entry:
     case PLY_INT:
       if (fprintf (fp, "%d ", int_val) <= 0)
         {
-          fprintf(stderr, "PLY ERROR: fprintf() failed -- aborting.\n");
-          exit(1);
+          throw std::runtime_error("ply: fprintf() failed");
         }
       break;
     case PLY_UCHAR:
@@ -2745,16 +2709,14 @@ Entry:
     case PLY_UINT:
       if (fprintf (fp, "%u ", uint_val) <= 0)
         {
-          fprintf(stderr, "PLY ERROR: fprintf() failed -- aborting.\n");
-          exit(1);
+          throw std::runtime_error("ply: fprintf() failed");
         }
       break;
     case PLY_FLOAT:
     case PLY_DOUBLE:
       if (fprintf (fp, "%g ", double_val) <= 0)
         {
-          fprintf(stderr, "PLY ERROR: fprintf() failed -- aborting.\n");
-          exit(1);
+          throw std::runtime_error("ply: fprintf() failed");
         }
       break;
     default:
@@ -2938,8 +2900,7 @@ Exit:
 
     if (fread (ptr, ply_type_size[type], 1, fp) != 1)
       {
-        fprintf(stderr, "PLY ERROR: fread() failed -- aborting.\n");
-        exit(1);
+        throw std::runtime_error("ply: fread() failed");
       }
   
 
@@ -0,0 +1,198 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/*! \file benchNumbers.cpp measures how many values per second
+    toFloat/toInt decode, compared to atof/atoi on a std::string copy
+    of each token (which is what the parser used to do), and checks
+    that both give bit-identical results. the numbers are either the
+    numeric tokens of given pbrt file, or randomly generated ones */
+
+// pbrt
+#include "pbrt/Number.h"
+// ospcommon
+#include "ospcommon/common.h"
+// stl
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <cmath>
+
+namespace pbrt_parser {
+
+  using std::cout;
+  using std::endl;
+
+  /*! the numbers to parse: 'text' holds them all, separated by
+    spaces, and the views point into it */
+  struct Numbers {
+    std::string           text;
+    std::vector<TextView> floats;
+    std::vector<TextView> ints;
+
+    /*! split 'text' into its tokens, and keep those that look like
+      numbers - all of them as floats, the ones without a fraction
+      or exponent also as ints */
+    void collect()
+    {
+      const char *s = text.data(), *end = s+text.size();
+      while (s < end) {
+        while (s < end && (isspace(*s) || *s == '[' || *s == ']')) ++s;
+        const char *begin = s;
+        while (s < end && !isspace(*s) && *s != '[' && *s != ']') ++s;
+        if (begin == s || !(isdigit(*begin) || strchr("+-.",*begin))) continue;
+        floats.push_back(TextView(begin,s));
+        bool isInt = true;
+        for (const char *c = begin; c < s; c++)
+          isInt &= (isdigit(*c) || ((*c == '-' || *c == '+') && c == begin));
+        if (isInt) ints.push_back(TextView(begin,s));
+      }
+    }
+  };
+
+  void readNumbers(Numbers &numbers, const std::string &fileName)
+  {
+    std::ifstream in(fileName.c_str(),std::ios::binary);
+    if (!in.good())
+      THROW_RUNTIME_ERROR("could not open '"+fileName+"'");
+    std::stringstream ss;
+    ss << in.rdbuf();
+    numbers.text = ss.str();
+    numbers.collect();
+  }
+
+  /*! 'count' random values, in all the formats exporters write
+    (%g, %e, %f, integers), plus a few edge cases */
+  void generateNumbers(Numbers &numbers, size_t count)
+  {
+    std::mt19937 rng(0x5eed);
+    std::uniform_real_distribution<float> mantissa(-1.f,1.f);
+    std::uniform_int_distribution<int>    exponent(-12,12);
+    std::uniform_int_distribution<int>    integer(-1000000,1000000);
+    std::stringstream ss;
+    char buf[64];
+    for (size_t i=0;i<count;i++) {
+      const float f = mantissa(rng)*powf(10.f,(float)exponent(rng));
+      switch (i % 4) {
+      case 0: snprintf(buf,sizeof(buf),"%g",f); break;
+      case 1: snprintf(buf,sizeof(buf),"%e",f); break;
+      case 2: snprintf(buf,sizeof(buf),"%f",f); break;
+      case 3: snprintf(buf,sizeof(buf),"%i",integer(rng)); break;
+      }
+      ss << buf << ' ';
+    }
+    ss << "0 -0 +1 .5 -.5 5. 1e38 1e-38 1e-45 3.4028235e38 "
+       << "0.1000000000000000000000001 123456789012345678901234.5 "
+       << "2147483647 -2147483648 inf -inf nan 1e 1e+ -";
+    numbers.text = ss.str();
+    numbers.collect();
+  }
+
+  /*! run 'parse' over all 'values' 'numRounds' times, and return
+    the best rate, in values per second */
+  template<typename Parse>
+  double measure(const std::vector<TextView> &values, int numRounds, Parse parse)
+  {
+    double best = 0.;
+    for (int round=0;round<numRounds;round++) {
+      const double t0 = ospcommon::getSysTime();
+      for (const TextView &value : values)
+        parse(value);
+      const double t1 = ospcommon::getSysTime();
+      best = std::max(best,values.size()/(t1-t0));
+    }
+    return best;
+  }
+
+  void benchNumbers(int ac, char **av)
+  {
+    std::string fileName;
+    size_t count = 4000000;
+    int numRounds = 5;
+    for (int i=1;i<ac;i++) {
+      const std::string arg = av[i];
+      if (arg[0] == '-') {
+        if (arg == "--count")
+          count = atol(av[++i]);
+        else if (arg == "--rounds")
+          numRounds = atoi(av[++i]);
+        else
+          THROW_RUNTIME_ERROR("invalid argument '"+arg+"'");
+      } else {
+        fileName = arg;
+      }
+    }
+
+    Numbers numbers;
+    if (fileName != "")
+      readNumbers(numbers,fileName);
+    else
+      generateNumbers(numbers,count);
+    cout << "parsing " << numbers.floats.size() << " floats and "
+         << numbers.ints.size() << " ints, best of " << numRounds << endl;
+
+    size_t numMismatches = 0;
+    for (const TextView &value : numbers.floats) {
+      const float expected = (float)atof(value.str().c_str());
+      const float result   = toFloat(value);
+      if (memcmp(&expected,&result,sizeof(float)) != 0 && numMismatches++ < 10)
+        cout << "mismatch: '" << value.str() << "' gives " << result
+             << " instead of " << expected << endl;
+    }
+    for (const TextView &value : numbers.ints) {
+      if (toInt(value) != atoi(value.str().c_str()) && numMismatches++ < 10)
+        cout << "mismatch: '" << value.str() << "' gives " << toInt(value)
+             << " instead of " << atoi(value.str().c_str()) << endl;
+    }
+
+    /* sums, so the compiler can't drop the parsing */
+    volatile float floatSum = 0.f;
+    volatile int   intSum   = 0;
+    const double atofRate
+      = measure(numbers.floats,numRounds,[&](const TextView &v) { floatSum += (float)atof(v.str().c_str()); });
+    const double toFloatRate
+      = measure(numbers.floats,numRounds,[&](const TextView &v) { floatSum += toFloat(v); });
+    const double atoiRate
+      = measure(numbers.ints,numRounds,[&](const TextView &v) { intSum += atoi(v.str().c_str()); });
+    const double toIntRate
+      = measure(numbers.ints,numRounds,[&](const TextView &v) { intSum += toInt(v); });
+
+    printf("float: atof(std::string) %6.1fM/s -> toFloat(TextView) %6.1fM/s\n",
+           atofRate*1e-6,toFloatRate*1e-6);
+    printf("int:   atoi(std::string) %6.1fM/s -> toInt(TextView)   %6.1fM/s\n",
+           atoiRate*1e-6,toIntRate*1e-6);
+    if (numMismatches) {
+      cout << numMismatches << " values differ from atof/atoi" << endl;
+      exit(1);
+    }
+  }
+
+} // ::pbrt_parser
+
+int main(int ac, char **av)
+{
+  try {
+    pbrt_parser::benchNumbers(ac,av);
+  } catch (std::runtime_error e) {
+    std::cout << "**** ERROR ****" << std::endl << e.what() << std::endl;
+    exit(1);
+  }
+  return 0;
+}
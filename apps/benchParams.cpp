@@ -0,0 +1,139 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/*! \file benchParams.cpp measures how fast the parser gets through
+    parameter-heavy input: Moana-style material files, made up of
+    nothing but Texture and MakeNamedMaterial blocks with a dozen or
+    more parameters each - generated, or read from given file. it
+    reports the time for just lexing the input next to the time for
+    parsing it, so the difference is what decoding the parameter
+    declarations and values (and building the scene) costs */
+
+// pbrt
+#include "pbrt/Parser.h"
+// ospcommon
+#include "ospcommon/common.h"
+// stl
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+namespace pbrt_parser {
+
+  using std::cout;
+  using std::endl;
+
+  /*! 'count' Texture and 'count' MakeNamedMaterial blocks, with 16
+    parameters each, in the style of Moana's material files */
+  std::string generateMaterials(size_t count)
+  {
+    std::stringstream ss;
+    ss << "WorldBegin" << endl;
+    for (size_t i=0;i<count;i++) {
+      ss << "Texture \"tex" << i << "\" \"spectrum\" \"imagemap\"" << endl
+         << "  \"string filename\" \"textures/tex" << i << ".png\"" << endl
+         << "  \"string wrap\" \"repeat\" \"float scale\" 1 \"bool gamma\" \"true\"" << endl
+         << "  \"float maxanisotropy\" 8 \"bool trilinear\" \"false\"" << endl
+         << "  \"string mapping\" \"uv\" \"float uscale\" 1 \"float vscale\" 1" << endl
+         << "  \"float udelta\" 0 \"float vdelta\" 0 \"rgb tint\" [ 1 1 1 ]" << endl
+         << "  \"float brightness\" 1 \"integer channel\" 0 \"string encoding\" \"sRGB\"" << endl
+         << "  \"float invert\" 0" << endl;
+      ss << "MakeNamedMaterial \"mtl" << i << "\"" << endl
+         << "  \"string type\" \"disney\" \"texture color\" \"tex" << i << "\"" << endl
+         << "  \"float metallic\" 0 \"float eta\" 1.5 \"float roughness\" 0.35" << endl
+         << "  \"float speculartint\" 0 \"float anisotropic\" 0 \"float sheen\" 0" << endl
+         << "  \"float sheentint\" 0.5 \"float clearcoat\" 0 \"float clearcoatgloss\" 1" << endl
+         << "  \"float spectrans\" 0 \"rgb scatterdistance\" [ 0 0 0 ]" << endl
+         << "  \"bool thin\" \"false\" \"float flatness\" 0 \"float difftrans\" 1" << endl;
+    }
+    ss << "WorldEnd" << endl;
+    return ss.str();
+  }
+
+  void benchParams(int ac, char **av)
+  {
+    std::string fileName;
+    size_t count = 40000;
+    int numRounds = 3;
+    for (int i=1;i<ac;i++) {
+      const std::string arg = av[i];
+      if (arg[0] == '-') {
+        if (arg == "--count")
+          count = atol(av[++i]);
+        else if (arg == "--rounds")
+          numRounds = atoi(av[++i]);
+        else
+          THROW_RUNTIME_ERROR("invalid argument '"+arg+"'");
+      } else {
+        fileName = arg;
+      }
+    }
+
+    std::string text;
+    if (fileName != "") {
+      std::ifstream in(fileName.c_str(),std::ios::binary);
+      if (!in.good())
+        THROW_RUNTIME_ERROR("could not open '"+fileName+"'");
+      std::stringstream ss;
+      ss << in.rdbuf();
+      text = ss.str();
+    } else {
+      fileName = "<generated>";
+      text = generateMaterials(count);
+    }
+
+    double bestLex = 1e20, bestParse = 1e20;
+    size_t numParams = 0;
+    for (int round=0;round<numRounds;round++) {
+      const double t0 = ospcommon::getSysTime();
+      Lexer lexer(fileName,text.data(),text.size());
+      /* parameter declarations are the strings of the form "type name" */
+      numParams = 0;
+      while (Token token = lexer.next())
+        numParams += (token.type == Token::TOKEN_TYPE_STRING
+                      && memchr(token.text.begin,' ',token.text.size) != nullptr);
+      const double t1 = ospcommon::getSysTime();
+      bestLex = std::min(bestLex,t1-t0);
+
+      Parser parser(false,"");
+      parser.logSink = nullptr;
+      const double t2 = ospcommon::getSysTime();
+      parser.parse(fileName,text.data(),text.size());
+      const double t3 = ospcommon::getSysTime();
+      bestParse = std::min(bestParse,t3-t2);
+    }
+
+    printf("%s: %.1fMB, %zu parameters, best of %i\n",
+           fileName.c_str(),text.size()*1e-6,numParams,numRounds);
+    printf("lexing only: %.3fs\n",bestLex);
+    printf("parsing:     %.3fs (%.1fM parameters/s)\n",bestParse,numParams/bestParse*1e-6);
+  }
+
+} // ::pbrt_parser
+
+int main(int ac, char **av)
+{
+  try {
+    pbrt_parser::benchParams(ac,av);
+  } catch (std::runtime_error e) {
+    std::cout << "**** ERROR ****" << std::endl << e.what() << std::endl;
+    exit(1);
+  }
+  return 0;
+}
@@ -31,8 +31,13 @@ namespace pbrt_parser {
   // the output file we're writing.
   FILE *out = NULL;
 
+  // the scene we're exporting (shapes and instances refer to its
+  // transform table)
+  std::shared_ptr<Scene> scene;
+
   size_t numWritten = 0;
   size_t numVerticesWritten = 0;
+  size_t numTexcoordsWritten = 0;
 
   std::string exportMaterial(std::shared_ptr<Material> material)
   {
@@ -48,13 +53,14 @@ namespace pbrt_parser {
       return ss.str();
     }
 
-    const std::string type = material->type;
-    if (type == "mix") {
+    static const Symbol mixType("mix"), uberType("uber");
+    const Symbol type = material->type;
+    if (type == mixType) {
       std::string matName = "pbrt_parser_error_material";
       alreadyExported[material] = matName;
       return "usemtl pbrt_parser_error_material\n\n";
       //      throw std::runtime_error("'mix' material ..."+material->toString());
-    } else if (type == "uber") {
+    } else if (type == uberType) {
       std::string matName = std::string("uber_material__")+std::to_string((unsigned long long)alreadyExported.size());
       ss << "newmtl " << matName << std::endl;
       { //----------- Kd -----------
@@ -78,112 +84,43 @@ namespace pbrt_parser {
   }
 
   
-  void writeTriangleMesh(std::shared_ptr<Shape> shape, const affine3f &instanceXfm)
+  void writeTriangleMesh(std::shared_ptr<TriangleMesh> mesh, const affine3f &instanceXfm)
   {
     /*! call 'exportMateiral, which will return a string that properly
         defined and/or activates the given mateirla */
-    std::string materialString = exportMaterial(shape->material);
+    std::string materialString = exportMaterial(mesh->material);
     fprintf(out,"%s\n",materialString.c_str());
 
-    const affine3f xfm = instanceXfm*shape->transform;
+    mesh->load();
+    const affine3f xfm = instanceXfm*scene->transforms[mesh->transformID];
     size_t firstVertexID = numVerticesWritten+1;
+    size_t firstTexcoordID = numTexcoordsWritten+1;
 
-    std::shared_ptr<ParamT<float> > param_st = shape->findParam<float>("st");
-    if (param_st) {
-      const size_t numPoints = param_st->paramVec.size() / 2;
-      for (int i=0;i<numPoints;i++) {
-        vec2f v(param_st->paramVec[2*i+0],
-                param_st->paramVec[2*i+1]);
-        fprintf(out,"vt %f %f\n",v.x,v.y);
-      }
+    for (const vec2f &v : mesh->texcoord) {
+      fprintf(out,"vt %f %f\n",v.x,v.y);
+      numTexcoordsWritten++;
     }
     
-    { // parse "point P"
-      std::shared_ptr<ParamT<float> > param_P = shape->findParam<float>("P");
-      if (param_P) {
-        const size_t numPoints = param_P->paramVec.size() / 3;
-        for (int i=0;i<numPoints;i++) {
-          vec3f v(param_P->paramVec[3*i+0],
-                  param_P->paramVec[3*i+1],
-                  param_P->paramVec[3*i+2]);
-          v = xfmPoint(xfm,v);
-          fprintf(out,"v %f %f %f\n",v.x,v.y,v.z);
-          numVerticesWritten++;
-        }
-      }
-    }
-
-    { // parse "int indices"
-      std::shared_ptr<ParamT<int> > param_indices = shape->findParam<int>("indices");
-      if (param_indices) {
-          
-        const size_t numIndices = param_indices->paramVec.size() / 3;
-        for (int i=0;i<numIndices;i++) {
-          vec3i v(param_indices->paramVec[3*i+0],
-                  param_indices->paramVec[3*i+1],
-                  param_indices->paramVec[3*i+2]);
-          if (param_st) {
-            fprintf(out,"f %lu//%lu %lu//%lu %lu//%lu\n",
-                    firstVertexID+v.x,
-                    firstVertexID+v.x,
-                    firstVertexID+v.y,
-                    firstVertexID+v.y,
-                    firstVertexID+v.z,
-                    firstVertexID+v.z);
-          } else {
-            fprintf(out,"f %lu %lu %lu\n",firstVertexID+v.x,firstVertexID+v.y,firstVertexID+v.z);
-          }
-          numWritten++;
-        }
-      }
-    }        
-  }
-
-  void parsePLY(const std::string &fileName,
-                std::vector<vec3f> &v,
-                std::vector<vec3f> &n,
-                std::vector<vec3i> &idx);
-
-  void writePlyMesh(std::shared_ptr<Shape> shape, const affine3f &instanceXfm)
-  {
-    /*! call 'exportMateiral, which will return a string that properly
-        defined and/or activates the given mateirla */
-    std::string materialString = exportMaterial(shape->material);
-    fprintf(out,"%s\n",materialString.c_str());
-
-
-    std::vector<vec3f> p, n;
-    std::vector<vec3i> idx;
-      
-    std::shared_ptr<ParamT<std::string> > param_fileName = shape->findParam<std::string>("filename");
-    FileName fn = FileName(basePath) + param_fileName->paramVec[0];
-    parsePLY(fn.str(),p,n,idx);
-
-    const affine3f xfm = instanceXfm*shape->transform;
-    size_t firstVertexID = numVerticesWritten+1;
-
-    for (int i=0;i<p.size();i++) {
-      vec3f v = xfmPoint(xfm,p[i]);
+    for (const vec3f &p : mesh->vertex) {
+      const vec3f v = xfmPoint(xfm,p);
       fprintf(out,"v %f %f %f\n",v.x,v.y,v.z);
       numVerticesWritten++;
     }
 
-    for (int i=0;i<idx.size();i++) {
-      vec3i v = idx[i];
-      fprintf(out,"f %lu %lu %lu\n",
-              firstVertexID+v.x,
-              firstVertexID+v.y,
-              firstVertexID+v.z);
+    for (const vec3i &v : mesh->index) {
+      if (!mesh->texcoord.empty()) {
+        fprintf(out,"f %lu/%lu %lu/%lu %lu/%lu\n",
+                firstVertexID+v.x,
+                firstTexcoordID+v.x,
+                firstVertexID+v.y,
+                firstTexcoordID+v.y,
+                firstVertexID+v.z,
+                firstTexcoordID+v.z);
+      } else {
+        fprintf(out,"f %lu %lu %lu\n",firstVertexID+v.x,firstVertexID+v.y,firstVertexID+v.z);
+      }
       numWritten++;
     }
-#if 0
-    static long numObjectsWritten = 0;
-    if (++numObjectsWritten > 100) {
-      std::cout << "written more than 100 objects .... exiting" << std::endl;
-      fflush(out); exit(0);
-    }
-#endif
-
   }
 
   void defineDefaultMaterials(FILE *file)
@@ -204,16 +141,14 @@ namespace pbrt_parser {
     cout << "writing " << object->toString() << endl;
     for (int shapeID=0;shapeID<object->shapes.size();shapeID++) {
       std::shared_ptr<Shape> shape = object->shapes[shapeID];
-      if (shape->type == "trianglemesh") {
-        writeTriangleMesh(shape,instanceXfm);
-      } else if (shape->type == "plymesh") {
-        writePlyMesh(shape,instanceXfm);
+      if (std::shared_ptr<TriangleMesh> mesh = std::dynamic_pointer_cast<TriangleMesh>(shape)) {
+        writeTriangleMesh(mesh,instanceXfm);
       } else 
         cout << "**** invalid shape #" << shapeID << " : " << shape->type << endl;
     }
     for (int instID=0;instID<object->objectInstances.size();instID++) {
       writeObject(object->objectInstances[instID]->object,
-                  instanceXfm*object->objectInstances[instID]->xfm);
+                  instanceXfm*scene->transforms[object->objectInstances[instID]->transformID]);
     }
   }
 
@@ -222,6 +157,8 @@ namespace pbrt_parser {
   {
     std::vector<std::string> fileName;
     bool dbg = false;
+    LexerConfig lexerConfig;
+    bool lazy = false;
     std::string outFileName = "a.obj";
     for (int i=1;i<ac;i++) {
       const std::string arg = av[i];
@@ -232,6 +169,16 @@ namespace pbrt_parser {
           basePath = av[++i];
         else if (arg == "-o")
           outFileName = av[++i];
+        else if (arg == "--lexer-threads" || arg == "-lt")
+          lexerConfig.numThreads = atoi(av[++i]);
+        else if (arg == "--no-mmap")
+          lexerConfig.mapped = false;
+        else if (arg == "--read-buffer-size")
+          lexerConfig.readBufferSize = atol(av[++i]);
+        else if (arg == "--read-buffers")
+          lexerConfig.numReadBuffers = atoi(av[++i]);
+        else if (arg == "--lazy")
+          lazy = true;
         else
           THROW_RUNTIME_ERROR("invalid argument '"+arg+"'");
       } else {
@@ -254,13 +201,18 @@ namespace pbrt_parser {
       basePath = FileName(fileName[0]).path();
   
     pbrt_parser::Parser *parser = new pbrt_parser::Parser(dbg,basePath);
+    parser->lexerConfig = lexerConfig;
+    parser->lazyArrays = lazy;
     try {
       for (int i=0;i<fileName.size();i++)
         parser->parse(fileName[i]);
     
       std::cout << "==> parsing successful (grammar only for now)" << std::endl;
+      if (dbg)
+        std::cout << "(spent " << parser->secondsBlockedOnInput
+                  << "s waiting for input)" << std::endl;
     
-      std::shared_ptr<Scene> scene = parser->getScene();
+      scene = parser->getScene();
       writeObject(scene->world,ospcommon::one);
       fclose(out);
       cout << "Done exporting to OBJ; wrote a total of " << numWritten << " triangles" << endl;
@@ -32,6 +32,10 @@ namespace pbrt_parser {
   FILE *out = NULL;
   FILE *bin = NULL;
 
+  // the scene we're exporting (shapes and instances refer to its
+  // transform table)
+  std::shared_ptr<Scene> scene;
+
   size_t numUniqueTriangles = 0;
   size_t numInstancedTriangles = 0;
   size_t numUniqueObjects = 0;
@@ -112,9 +116,10 @@ namespace pbrt_parser {
     if (alreadyExported.find(texturedMaterial) != alreadyExported.end())
       return alreadyExported[texturedMaterial];
 
-    const std::string type = material->type;
+    static const Symbol disneyType("disney"), uberType("uber");
+    const Symbol type = material->type;
 
-    if (type == "disney") {
+    if (type == disneyType) {
       std::stringstream ss;
       ss << "<Material name=\"name\" type=\"DisneyMaterial\">" << endl;
       ss << genMaterialParam<vec3f>(material,"color");
@@ -141,7 +146,7 @@ namespace pbrt_parser {
       int thisID = nextNodeID++;
       alreadyExported[texturedMaterial] = thisID;
       return thisID;
-    } else if (type == "uber") {
+    } else if (type == uberType) {
       std::stringstream ss;
       ss << "<Material name=\"doesntMatter\" type=\"OBJMaterial\">" << endl;
       {
@@ -173,23 +178,27 @@ namespace pbrt_parser {
     }
   }
 
-  int writeTriangleMesh(std::shared_ptr<Shape> shape, const affine3f &instanceXfm)
+  int writeTriangleMesh(std::shared_ptr<TriangleMesh> mesh, const affine3f &instanceXfm)
   {
     numUniqueObjects++;
-    std::shared_ptr<Material> mat = shape->material;
-    cout << "writing shape " << shape->toString() << " w/ material " << (mat?mat->toString():"<null>") << endl;
+    std::shared_ptr<Material> mat = mesh->material;
+    cout << "writing shape " << mesh->toString() << " w/ material " << (mat?mat->toString():"<null>") << endl;
 
-    std::string texture_color   = shape->getParamString("color");
-    std::string texture_bumpmap = shape->getParamString("bumpmap");
-    int materialID = exportMaterial(shape->material,texture_color,texture_bumpmap);
+    /* ply meshes always get the default material */
+    static const Symbol plyMeshType("plymesh");
+    const bool isPlyMesh = (mesh->type == plyMeshType);
+    std::string texture_color   = isPlyMesh ? "" : mesh->getParamString("color");
+    std::string texture_bumpmap = isPlyMesh ? "" : mesh->getParamString("bumpmap");
+    int materialID = isPlyMesh ? 0 : exportMaterial(mesh->material,texture_color,texture_bumpmap);
 
+    mesh->load();
     int thisID = nextNodeID++;
-    const affine3f xfm = instanceXfm*shape->transform;
+    const affine3f xfm = instanceXfm*scene->transforms[mesh->transformID];
     // PRINT(instanceXfm);
     // PRINT(shape->transform);
     // PRINT(xfm);
 
-    alreadyExported[shape] = thisID;
+    alreadyExported[mesh] = thisID;
     transformOfFirstInstance[thisID] = xfm;
 
     fprintf(out,"<Mesh id=\"%i\">\n",thisID);
@@ -198,101 +207,32 @@ namespace pbrt_parser {
       if (texture_bumpmap != "")
         fprintf(out,"  <displacement name=\"%s\"/>\n",texture_bumpmap.c_str());
     }
-    { // parse "point P"
-      std::shared_ptr<ParamT<float> > param_P = shape->findParam<float>("P");
-      if (param_P) {
-        size_t ofs = ftell(bin);
-        const size_t numPoints = param_P->paramVec.size() / 3;
-        for (int i=0;i<numPoints;i++) {
-          vec3f v(param_P->paramVec[3*i+0],
-                  param_P->paramVec[3*i+1],
-                  param_P->paramVec[3*i+2]);
-          v = xfmPoint(xfm,v);
-          fwrite(&v,sizeof(v),1,bin);
-          // fprintf(out,"v %f %f %f\n",v.x,v.y,v.z);
-          // numVerticesWritten++;
-        }
-          
-        fprintf(out,"  <vertex num=\"%li\" ofs=\"%li\"/>\n",
-                numPoints,ofs);
-      }
-        
+    { // vertices, transformed, in one bulk write
+      size_t ofs = ftell(bin);
+      std::vector<vec3f> vertices(mesh->vertex.size());
+      for (size_t i=0;i<vertices.size();i++)
+        vertices[i] = xfmPoint(xfm,mesh->vertex[i]);
+      fwrite(vertices.data(),sizeof(vec3f),vertices.size(),bin);
+      fprintf(out,"  <vertex num=\"%li\" ofs=\"%li\"/>\n",
+              vertices.size(),ofs);
     }
       
-    { // parse "int indices"
-      std::shared_ptr<ParamT<int> > param_indices = shape->findParam<int>("indices");
-      if (param_indices) {
-        size_t ofs = ftell(bin);
-        const size_t numIndices = param_indices->paramVec.size() / 3;
-        numTrisOfInstance[thisID] = numIndices;
-        numUniqueTriangles+=numIndices;
-        for (int i=0;i<numIndices;i++) {
-          vec4i v(param_indices->paramVec[3*i+0],
-                  param_indices->paramVec[3*i+1],
-                  param_indices->paramVec[3*i+2],
-                  0);
-          fwrite(&v,sizeof(v),1,bin);
-        }
-        fprintf(out,"  <prim num=\"%li\" ofs=\"%li\"/>\n",
-                numIndices,ofs);
-      }
+    { // indices, padded to vec4i's
+      size_t ofs = ftell(bin);
+      const size_t numTriangles = mesh->index.size();
+      numTrisOfInstance[thisID] = numTriangles;
+      numUniqueTriangles+=numTriangles;
+      std::vector<vec4i> prims(numTriangles);
+      for (size_t i=0;i<numTriangles;i++)
+        prims[i] = vec4i(mesh->index[i].x,mesh->index[i].y,mesh->index[i].z,0);
+      fwrite(prims.data(),sizeof(vec4i),prims.size(),bin);
+      fprintf(out,"  <prim num=\"%li\" ofs=\"%li\"/>\n",
+              numTriangles,ofs);
     }        
     fprintf(out,"</Mesh>\n");
     return thisID;
   }
 
-  void parsePLY(const std::string &fileName,
-                std::vector<vec3f> &v,
-                std::vector<vec3f> &n,
-                std::vector<vec3i> &idx);
-
-  int writePlyMesh(std::shared_ptr<Shape> shape, const affine3f &instanceXfm)
-  {
-    std::vector<vec3f> p, n;
-    std::vector<vec3i> idx;
-      
-    numUniqueObjects++;
-    std::shared_ptr<Material> mat = shape->material;
-    cout << "writing shape " << shape->toString() << " w/ material " << (mat?mat->toString():"<null>") << endl;
-
-    std::shared_ptr<ParamT<std::string> > param_fileName = shape->findParam<std::string>("filename");
-    FileName fn = FileName(basePath) + param_fileName->paramVec[0];
-    parsePLY(fn.str(),p,n,idx);
-
-    int thisID = nextNodeID++;
-    const affine3f xfm = instanceXfm*shape->transform;
-    alreadyExported[shape] = thisID;
-    transformOfFirstInstance[thisID] = xfm;
-      
-    // -------------------------------------------------------
-    fprintf(out,"<Mesh id=\"%i\">\n",thisID);
-    fprintf(out,"  <materiallist>0</materiallist>\n");
-
-    // -------------------------------------------------------
-    fprintf(out,"  <vertex num=\"%li\" ofs=\"%li\"/>\n",
-            p.size(),ftell(bin));
-    for (int i=0;i<p.size();i++) {
-      vec3f v = xfmPoint(xfm,p[i]);
-      fwrite(&v,sizeof(v),1,bin);
-    }
-
-    // -------------------------------------------------------
-    fprintf(out,"  <prim num=\"%li\" ofs=\"%li\"/>\n",
-            idx.size(),ftell(bin));
-    for (int i=0;i<idx.size();i++) {
-      vec3i v = idx[i];
-      fwrite(&v,sizeof(v),1,bin);
-      int z = 0.f;
-      fwrite(&z,sizeof(z),1,bin);
-    }
-    numTrisOfInstance[thisID] = idx.size();
-    numUniqueTriangles += idx.size();
-    // -------------------------------------------------------
-    fprintf(out,"</Mesh>\n");
-    // -------------------------------------------------------
-    return thisID;
-  }
-
   void writeObject(const std::shared_ptr<Object> &object, 
                    const affine3f &instanceXfm)
   {
@@ -338,14 +278,8 @@ namespace pbrt_parser {
         continue;
       } 
       
-      if (shape->type == "trianglemesh") {
-        int thisID = writeTriangleMesh(shape,instanceXfm);
-        rootObjects.push_back(thisID);
-        continue;
-      }
-
-      if (shape->type == "plymesh") {
-        int thisID = writePlyMesh(shape,instanceXfm);
+      if (std::shared_ptr<TriangleMesh> mesh = std::dynamic_pointer_cast<TriangleMesh>(shape)) {
+        int thisID = writeTriangleMesh(mesh,instanceXfm);
         rootObjects.push_back(thisID);
         continue;
       }
@@ -354,7 +288,7 @@ namespace pbrt_parser {
     }
     for (int instID=0;instID<object->objectInstances.size();instID++) {
       writeObject(object->objectInstances[instID]->object,
-                  instanceXfm*object->objectInstances[instID]->xfm);
+                  instanceXfm*scene->transforms[object->objectInstances[instID]->transformID]);
     }      
   }
 
@@ -363,6 +297,8 @@ namespace pbrt_parser {
   {
     std::vector<std::string> fileName;
     bool dbg = false;
+    LexerConfig lexerConfig;
+    bool lazy = false;
     std::string outFileName = "a.xml";
     for (int i=1;i<ac;i++) {
       const std::string arg = av[i];
@@ -373,6 +309,16 @@ namespace pbrt_parser {
           basePath = av[++i];
         else if (arg == "-o")
           outFileName = av[++i];
+        else if (arg == "--lexer-threads" || arg == "-lt")
+          lexerConfig.numThreads = atoi(av[++i]);
+        else if (arg == "--no-mmap")
+          lexerConfig.mapped = false;
+        else if (arg == "--read-buffer-size")
+          lexerConfig.readBufferSize = atol(av[++i]);
+        else if (arg == "--read-buffers")
+          lexerConfig.numReadBuffers = atoi(av[++i]);
+        else if (arg == "--lazy")
+          lazy = true;
         else
           THROW_RUNTIME_ERROR("invalid argument '"+arg+"'");
       } else {
@@ -402,13 +348,18 @@ namespace pbrt_parser {
       basePath = FileName(fileName[0]).path();
   
     std::shared_ptr<pbrt_parser::Parser> parser = std::make_shared<pbrt_parser::Parser>(dbg,basePath);
+    parser->lexerConfig = lexerConfig;
+    parser->lazyArrays = lazy;
     try {
       for (int i=0;i<fileName.size();i++)
         parser->parse(fileName[i]);
     
       std::cout << "==> parsing successful (grammar only for now)" << std::endl;
+      if (dbg)
+        std::cout << "(spent " << parser->secondsBlockedOnInput
+                  << "s waiting for input)" << std::endl;
     
-      std::shared_ptr<Scene> scene = parser->getScene();
+      scene = parser->getScene();
       writeObject(scene->world,ospcommon::one);
 
       {
@@ -0,0 +1,265 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+/*! \file AlignedVector.h std::vector-like array that stores a few
+    elements inline, and whose (larger) storage is cache-line aligned,
+    so it can go straight into SIMD code */
+
+#include "ospcommon/malloc.h"
+// std
+#include <new>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+#include <stdlib.h>
+#include <string.h>
+
+namespace pbrt_parser {
+
+  /*! std allocator that aligns allocations of at least
+    ALIGNED_MIN_SIZE bytes to 64 bytes. smaller ones come from plain
+    malloc, which aligns to 16 bytes on all common platforms, and
+    doesn't waste the padding */
+  template<typename T>
+  struct AlignedAllocator {
+    typedef T value_type;
+
+    static const size_t ALIGNMENT        = 64;
+    static const size_t ALIGNED_MIN_SIZE = 256;
+
+    AlignedAllocator() = default;
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+      const size_t size = n*sizeof(T);
+      void *ptr = (size >= ALIGNED_MIN_SIZE) ? ospcommon::alignedMalloc(size,ALIGNMENT) : malloc(size);
+      if (!ptr && size)
+        throw std::bad_alloc();
+      return (T *)ptr;
+    }
+    /*! 'n' is what it was allocated with, so tells us how */
+    void deallocate(T *ptr, size_t n)
+    {
+      if (n*sizeof(T) >= ALIGNED_MIN_SIZE)
+        ospcommon::alignedFree(ptr);
+      else
+        free(ptr);
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U> &) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U> &) const { return false; }
+  };
+
+  /*! array of Ts with (the commonly used subset of) std::vector's
+    interface. most parameters have only one to three values, so the
+    first INLINE_CAPACITY elements live right inside the array,
+    without any heap allocation; beyond that, storage comes from an
+    AlignedAllocator. note that, unlike with std::vector, swapping or
+    moving small arrays moves their elements */
+  template<typename T>
+  class AlignedVector {
+  public:
+    typedef T         value_type;
+    typedef T        *iterator;
+    typedef const T  *const_iterator;
+    typedef size_t    size_type;
+
+    /*! as many elements as fit into 16 bytes, but at least one */
+    static const size_t INLINE_CAPACITY = sizeof(T) >= 16 ? 1 : 16/sizeof(T);
+
+    AlignedVector() : ptr(inlineData()), count(0) {}
+    explicit AlignedVector(size_t n) : AlignedVector() { resize(n); }
+    AlignedVector(const AlignedVector &other) : AlignedVector()
+    { assign(other.begin(),other.end()); }
+    AlignedVector(AlignedVector &&other) noexcept : AlignedVector()
+    { takeFrom(other); }
+    ~AlignedVector() { clear(); release(); }
+
+    AlignedVector &operator=(const AlignedVector &other)
+    {
+      if (this != &other)
+        assign(other.begin(),other.end());
+      return *this;
+    }
+    AlignedVector &operator=(AlignedVector &&other) noexcept
+    {
+      if (this != &other) {
+        clear();
+        release();
+        takeFrom(other);
+      }
+      return *this;
+    }
+
+    size_t size()     const { return count; }
+    bool   empty()    const { return count == 0; }
+    size_t capacity() const { return isInline() ? INLINE_CAPACITY : heapCapacity; }
+
+    T       *data()       { return ptr; }
+    const T *data() const { return ptr; }
+    iterator       begin()       { return ptr; }
+    iterator       end()         { return ptr+count; }
+    const_iterator begin() const { return ptr; }
+    const_iterator end()   const { return ptr+count; }
+
+    T       &operator[](size_t i)       { return ptr[i]; }
+    const T &operator[](size_t i) const { return ptr[i]; }
+    T       &front()       { return ptr[0]; }
+    const T &front() const { return ptr[0]; }
+    T       &back()        { return ptr[count-1]; }
+    const T &back()  const { return ptr[count-1]; }
+
+    void reserve(size_t n)
+    {
+      if (n > capacity())
+        reallocate(n);
+    }
+    void resize(size_t n)
+    {
+      reserve(n);
+      for (size_t i=count;i<n;i++)
+        new (ptr+i) T();
+      destroy(std::min(n,count),count);
+      count = n;
+    }
+    void resize(size_t n, const T &value)
+    {
+      reserve(n);
+      for (size_t i=count;i<n;i++)
+        new (ptr+i) T(value);
+      destroy(std::min(n,count),count);
+      count = n;
+    }
+    void clear()
+    {
+      destroy(0,count);
+      count = 0;
+    }
+
+    template<typename... Args>
+    void emplace_back(Args&&... args)
+    {
+      if (count == capacity()) {
+        /* 'args' might refer to one of our elements */
+        T value(std::forward<Args>(args)...);
+        reallocate(2*count);
+        new (ptr+count) T(std::move(value));
+      } else
+        new (ptr+count) T(std::forward<Args>(args)...);
+      ++count;
+    }
+    void push_back(const T &value) { emplace_back(value); }
+    void push_back(T &&value)      { emplace_back(std::move(value)); }
+    void pop_back() { destroy(count-1,count); --count; }
+
+    template<typename It>
+    void assign(It first, It last)
+    {
+      clear();
+      reserve(std::distance(first,last));
+      for (;first != last;++first)
+        new (ptr+count++) T(*first);
+    }
+    void assign(size_t n, const T &value)
+    {
+      clear();
+      resize(n,value);
+    }
+
+    void swap(AlignedVector &other)
+    {
+      if (!isInline() && !other.isInline()) {
+        std::swap(ptr,other.ptr);
+        std::swap(count,other.count);
+        std::swap(heapCapacity,other.heapCapacity);
+        return;
+      }
+      AlignedVector tmp(std::move(other));
+      other = std::move(*this);
+      *this = std::move(tmp);
+    }
+
+  private:
+    bool     isInline()   const { return ptr == inlineData(); }
+    T       *inlineData()       { return (T *)&inlineStorage; }
+    const T *inlineData() const { return (const T *)&inlineStorage; }
+
+    void destroy(size_t begin, size_t end)
+    {
+      if (!std::is_trivially_destructible<T>::value)
+        for (size_t i=begin;i<end;i++)
+          ptr[i].~T();
+    }
+    /*! move our elements into 'to' (which has room for them) */
+    void relocate(T *to)
+    {
+      if (std::is_trivially_copyable<T>::value)
+        memcpy((void *)to,(const void *)ptr,count*sizeof(T));
+      else
+        for (size_t i=0;i<count;i++) {
+          new (to+i) T(std::move(ptr[i]));
+          ptr[i].~T();
+        }
+    }
+    void reallocate(size_t newCapacity)
+    {
+      newCapacity = std::max(newCapacity,(size_t)INLINE_CAPACITY+1);
+      T *newPtr = AlignedAllocator<T>().allocate(newCapacity);
+      relocate(newPtr);
+      release();
+      /* only now, as this overlaps the inline elements */
+      heapCapacity = newCapacity;
+      ptr = newPtr;
+    }
+    /*! free our heap storage, if any (leaving us inline) */
+    void release()
+    {
+      if (!isInline())
+        AlignedAllocator<T>().deallocate(ptr,heapCapacity);
+      ptr = inlineData();
+    }
+    /*! take over other's elements, leaving it empty; we have to be
+      empty and inline */
+    void takeFrom(AlignedVector &other)
+    {
+      if (other.isInline()) {
+        other.relocate(ptr);
+      } else {
+        ptr          = other.ptr;
+        heapCapacity = other.heapCapacity;
+        other.ptr    = other.inlineData();
+      }
+      count       = other.count;
+      other.count = 0;
+    }
+
+    T     *ptr;
+    size_t count;
+    union {
+      /*! if on the heap */
+      size_t heapCapacity;
+      typename std::aligned_storage<INLINE_CAPACITY*sizeof(T),alignof(T)>::type inlineStorage;
+    };
+  };
+
+} // ::pbrt_parser
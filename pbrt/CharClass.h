@@ -0,0 +1,268 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+/*! \file CharClass.h character classification and (vectorized)
+    scanning routines used by the lexer. All scanning routines look at
+    the chars in [begin,end) and return a pointer to the first char
+    they are looking for, or 'end' if there is none. The SIMD paths
+    get selected at compile time (AVX2, else SSE4.2, else SSE2); each
+    of them falls back to the scalar, table-driven code for the last
+    few chars of a buffer, so they never read past 'end'. */
+
+#include <stdint.h>
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+namespace pbrt_parser {
+
+  /*! character classes, as bits in charClassTable */
+  enum {
+    CHAR_CLASS_WHITE   = 1,
+    CHAR_CLASS_SPECIAL = 2,
+    CHAR_CLASS_QUOTE   = 4,
+    CHAR_CLASS_COMMENT = 8,
+    /*! any char that terminates a literal token */
+    CHAR_CLASS_DELIMITER
+    = CHAR_CLASS_WHITE|CHAR_CLASS_SPECIAL|CHAR_CLASS_QUOTE|CHAR_CLASS_COMMENT
+  };
+
+  /*! 256-entry table of char classes. note that '\0' counts as white
+    space, just like it always did in the (strchr-based) lexer */
+  struct CharClassTable {
+    CharClassTable()
+    {
+      for (int i=0;i<256;i++) cls[i] = 0;
+      cls[(unsigned char)' ']  = CHAR_CLASS_WHITE;
+      cls[(unsigned char)'\t'] = CHAR_CLASS_WHITE;
+      cls[(unsigned char)'\n'] = CHAR_CLASS_WHITE;
+      cls[(unsigned char)'\r'] = CHAR_CLASS_WHITE;
+      cls[0]                   = CHAR_CLASS_WHITE;
+      cls[(unsigned char)'[']  = CHAR_CLASS_SPECIAL;
+      cls[(unsigned char)',']  = CHAR_CLASS_SPECIAL;
+      cls[(unsigned char)']']  = CHAR_CLASS_SPECIAL;
+      cls[(unsigned char)'"']  = CHAR_CLASS_QUOTE;
+      cls[(unsigned char)'#']  = CHAR_CLASS_COMMENT;
+    }
+    inline int operator[](const char c) const { return cls[(unsigned char)c]; }
+
+    uint8_t cls[256];
+  };
+
+  extern const CharClassTable charClassTable;
+
+  inline bool isWhite(const char c)     { return charClassTable[c] & CHAR_CLASS_WHITE; }
+  inline bool isSpecial(const char c)   { return charClassTable[c] & CHAR_CLASS_SPECIAL; }
+  inline bool isDelimiter(const char c) { return charClassTable[c] & CHAR_CLASS_DELIMITER; }
+
+  // -------------------------------------------------------
+  // find given char
+  // -------------------------------------------------------
+  inline const char *findChar(const char *begin, const char *end, const char c)
+  {
+#if defined(__AVX2__)
+    const __m256i c8 = _mm256_set1_epi8(c);
+    for (;begin+32 <= end; begin += 32) {
+      const __m256i chars = _mm256_loadu_si256((const __m256i*)begin);
+      const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chars,c8));
+      if (mask) return begin+__builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    const __m128i c8 = _mm_set1_epi8(c);
+    for (;begin+16 <= end; begin += 16) {
+      const __m128i chars = _mm_loadu_si128((const __m128i*)begin);
+      const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chars,c8));
+      if (mask) return begin+__builtin_ctz(mask);
+    }
+#endif
+    for (;begin < end; ++begin)
+      if (*begin == c) return begin;
+    return end;
+  }
+
+  // -------------------------------------------------------
+  // skip white space
+  // -------------------------------------------------------
+  inline const char *skipWhite(const char *begin, const char *end)
+  {
+    /* most runs of white space are a single char, so check the first
+       two chars before going wide */
+    for (int i=0;i<2;i++,++begin) {
+      if (begin == end) return end;
+      if (!isWhite(*begin)) return begin;
+    }
+#if defined(__AVX2__)
+    for (;begin+32 <= end; begin += 32) {
+      const __m256i chars = _mm256_loadu_si256((const __m256i*)begin);
+      const __m256i white
+        = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars,_mm256_set1_epi8(' ')),
+                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8('\n'))),
+                          _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars,_mm256_set1_epi8('\t')),
+                                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8('\r'))),
+                                          _mm256_cmpeq_epi8(chars,_mm256_setzero_si256())));
+      const uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(white);
+      if (mask) return begin+__builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    for (;begin+16 <= end; begin += 16) {
+      const __m128i chars = _mm_loadu_si128((const __m128i*)begin);
+      const __m128i white
+        = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8(' ')),
+                                    _mm_cmpeq_epi8(chars,_mm_set1_epi8('\n'))),
+                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8('\t')),
+                                                 _mm_cmpeq_epi8(chars,_mm_set1_epi8('\r'))),
+                                    _mm_cmpeq_epi8(chars,_mm_setzero_si128())));
+      const uint32_t mask = 0xffff & ~(uint32_t)_mm_movemask_epi8(white);
+      if (mask) return begin+__builtin_ctz(mask);
+    }
+#endif
+    for (;begin < end; ++begin)
+      if (!isWhite(*begin)) return begin;
+    return end;
+  }
+
+  // -------------------------------------------------------
+  // find end of a literal token
+  // -------------------------------------------------------
+  inline const char *findDelimiter(const char *begin, const char *end)
+  {
+#if defined(__AVX2__)
+    for (;begin+32 <= end; begin += 32) {
+      const __m256i chars = _mm256_loadu_si256((const __m256i*)begin);
+      const __m256i white
+        = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars,_mm256_set1_epi8(' ')),
+                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8('\n'))),
+                          _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars,_mm256_set1_epi8('\t')),
+                                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8('\r'))),
+                                          _mm256_cmpeq_epi8(chars,_mm256_setzero_si256())));
+      const __m256i other
+        = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars,_mm256_set1_epi8('[')),
+                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8(']'))),
+                          _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars,_mm256_set1_epi8(',')),
+                                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8('"'))),
+                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8('#'))));
+      const uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(white,other));
+      if (mask) return begin+__builtin_ctz(mask);
+    }
+#elif defined(__SSE4_2__)
+    /* note: explicit-length compare, so a '\0' in the input is just
+       another char to match against (it's the last one in 'set') */
+    const __m128i set = _mm_setr_epi8(' ','\t','\n','\r','[',']',',','"','#',0,
+                                      0,0,0,0,0,0);
+    for (;begin+16 <= end; begin += 16) {
+      const __m128i chars = _mm_loadu_si128((const __m128i*)begin);
+      const int idx = _mm_cmpestri(set,10,chars,16,
+                                   _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY|_SIDD_LEAST_SIGNIFICANT);
+      if (idx < 16) return begin+idx;
+    }
+#elif defined(__SSE2__)
+    for (;begin+16 <= end; begin += 16) {
+      const __m128i chars = _mm_loadu_si128((const __m128i*)begin);
+      const __m128i white
+        = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8(' ')),
+                                    _mm_cmpeq_epi8(chars,_mm_set1_epi8('\n'))),
+                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8('\t')),
+                                                 _mm_cmpeq_epi8(chars,_mm_set1_epi8('\r'))),
+                                    _mm_cmpeq_epi8(chars,_mm_setzero_si128())));
+      const __m128i other
+        = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8('[')),
+                                    _mm_cmpeq_epi8(chars,_mm_set1_epi8(']'))),
+                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8(',')),
+                                                 _mm_cmpeq_epi8(chars,_mm_set1_epi8('"'))),
+                                    _mm_cmpeq_epi8(chars,_mm_set1_epi8('#'))));
+      const uint32_t mask = _mm_movemask_epi8(_mm_or_si128(white,other));
+      if (mask) return begin+__builtin_ctz(mask);
+    }
+#endif
+    for (;begin < end; ++begin)
+      if (isDelimiter(*begin)) return begin;
+    return end;
+  }
+
+  // -------------------------------------------------------
+  // find next special char, quote, or comment (ie, the next
+  // delimiter that isn't white space)
+  // -------------------------------------------------------
+  inline const char *findSpecial(const char *begin, const char *end)
+  {
+#if defined(__AVX2__)
+    for (;begin+32 <= end; begin += 32) {
+      const __m256i chars = _mm256_loadu_si256((const __m256i*)begin);
+      const __m256i other
+        = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars,_mm256_set1_epi8('[')),
+                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8(']'))),
+                          _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars,_mm256_set1_epi8(',')),
+                                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8('"'))),
+                                          _mm256_cmpeq_epi8(chars,_mm256_set1_epi8('#'))));
+      const uint32_t mask = _mm256_movemask_epi8(other);
+      if (mask) return begin+__builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    for (;begin+16 <= end; begin += 16) {
+      const __m128i chars = _mm_loadu_si128((const __m128i*)begin);
+      const __m128i other
+        = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8('[')),
+                                    _mm_cmpeq_epi8(chars,_mm_set1_epi8(']'))),
+                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8(',')),
+                                                 _mm_cmpeq_epi8(chars,_mm_set1_epi8('"'))),
+                                    _mm_cmpeq_epi8(chars,_mm_set1_epi8('#'))));
+      const uint32_t mask = _mm_movemask_epi8(other);
+      if (mask) return begin+__builtin_ctz(mask);
+    }
+#endif
+    for (;begin < end; ++begin)
+      if (isDelimiter(*begin) && !isWhite(*begin)) return begin;
+    return end;
+  }
+
+  // -------------------------------------------------------
+  // count white-space separated words
+  // -------------------------------------------------------
+  inline size_t countWords(const char *begin, const char *end)
+  {
+    size_t count = 0;
+    /* whether the char before 'begin' was a non-white one */
+    uint32_t inWord = 0;
+#if defined(__SSE2__)
+    for (;begin+16 <= end; begin += 16) {
+      const __m128i chars = _mm_loadu_si128((const __m128i*)begin);
+      const __m128i white
+        = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8(' ')),
+                                    _mm_cmpeq_epi8(chars,_mm_set1_epi8('\n'))),
+                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars,_mm_set1_epi8('\t')),
+                                                 _mm_cmpeq_epi8(chars,_mm_set1_epi8('\r'))),
+                                    _mm_cmpeq_epi8(chars,_mm_setzero_si128())));
+      const uint32_t word  = 0xffff & ~(uint32_t)_mm_movemask_epi8(white);
+      const uint32_t start = word & ~((word << 1) | inWord);
+      count += __builtin_popcount(start);
+      inWord = word >> 15;
+    }
+#endif
+    for (;begin < end; ++begin) {
+      const uint32_t word = !isWhite(*begin);
+      count += word & ~inWord;
+      inWord = word;
+    }
+    return count;
+  }
+
+} // ::pbrt_parser
@@ -0,0 +1,294 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "InputStream.h"
+// std
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#ifdef PBRT_PARSER_HAVE_ZLIB
+#  include <zlib.h>
+#endif
+#ifdef PBRT_PARSER_HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
+namespace pbrt_parser {
+
+  /*! size of the buffer compressed input gets read into */
+  static const size_t COMPRESSED_BUFFER_SIZE = 1<<18;
+
+  typedef enum { FORMAT_PLAIN, FORMAT_GZIP, FORMAT_ZSTD } Format;
+
+  /*! determine the file format from the file's first (up to 4) bytes */
+  static Format detectFormat(const unsigned char *begin, size_t size)
+  {
+    if (size >= 2 && begin[0] == 0x1f && begin[1] == 0x8b)
+      return FORMAT_GZIP;
+    if (size >= 4 && begin[0] == 0x28 && begin[1] == 0xb5 && begin[2] == 0x2f && begin[3] == 0xfd)
+      return FORMAT_ZSTD;
+    return FORMAT_PLAIN;
+  }
+
+  bool isCompressed(const unsigned char *begin, size_t size)
+  {
+    return detectFormat(begin,size) != FORMAT_PLAIN;
+  }
+
+  /*! a plain file */
+  struct StdioStream : public InputStream {
+    StdioStream(FILE *file, const std::string &name)
+      : file(file), name(name)
+    {}
+    virtual ~StdioStream() { fclose(file); }
+    virtual size_t read(char *dst, size_t size) override
+    {
+      const size_t numRead = fread(dst,1,size,file);
+      if (ferror(file))
+        throw std::runtime_error("error reading file '"+name+"'");
+      return numRead;
+    }
+    FILE             *file;
+    const std::string name;
+  };
+
+  /*! in-memory data */
+  struct MemoryStream : public InputStream {
+    MemoryStream(const char *data, size_t size)
+      : data(data), size(size), pos(0)
+    {}
+    virtual size_t read(char *dst, size_t numWanted) override
+    {
+      const size_t numRead = std::min(numWanted,size-pos);
+      memcpy(dst,data+pos,numRead);
+      pos += numRead;
+      return numRead;
+    }
+    const char  *data;
+    const size_t size;
+    size_t       pos;
+  };
+
+  /*! a std::istream */
+  struct StdStream : public InputStream {
+    StdStream(std::istream &in, const std::string &name)
+      : in(in), name(name)
+    {}
+    virtual size_t read(char *dst, size_t size) override
+    {
+      in.read(dst,size);
+      if (in.bad())
+        throw std::runtime_error("error reading '"+name+"'");
+      return in.gcount();
+    }
+    std::istream     &in;
+    const std::string name;
+  };
+
+  /*! base for the streams that read from an underlying 'raw' stream,
+    whose first few bytes have already been read (to determine the
+    format), and get served from 'head' */
+  struct FilterStream : public InputStream {
+    FilterStream(std::unique_ptr<InputStream> &raw, const std::string &name,
+                 const unsigned char *head, size_t headSize)
+      : raw(std::move(raw)), name(name), head(head,head+headSize), headPos(0)
+    {}
+
+    /*! read up to 'size' bytes from the raw stream */
+    size_t readRaw(char *dst, size_t size)
+    {
+      size_t numRead = std::min(size,head.size()-headPos);
+      memcpy(dst,head.data()+headPos,numRead);
+      headPos += numRead;
+      if (numRead < size)
+        numRead += raw->read(dst+numRead,size-numRead);
+      return numRead;
+    }
+
+    std::unique_ptr<InputStream> raw;
+    const std::string            name;
+    std::vector<unsigned char>   head;
+    size_t                       headPos;
+  };
+
+  /*! uncompressed data */
+  struct PlainStream : public FilterStream {
+    PlainStream(std::unique_ptr<InputStream> &raw, const std::string &name,
+                const unsigned char *head, size_t headSize)
+      : FilterStream(raw,name,head,headSize)
+    {}
+    virtual size_t read(char *dst, size_t size) override
+    { return readRaw(dst,size); }
+  };
+
+#ifdef PBRT_PARSER_HAVE_ZLIB
+  /*! gzip-compressed data, possibly consisting of several members */
+  struct GzipStream : public FilterStream {
+    GzipStream(std::unique_ptr<InputStream> &raw, const std::string &name,
+               const unsigned char *head, size_t headSize)
+      : FilterStream(raw,name,head,headSize),
+        in(COMPRESSED_BUFFER_SIZE), memberDone(false)
+    {
+      memset(&z,0,sizeof(z));
+      /* 16+: expect a gzip (rather than a zlib) header */
+      if (inflateInit2(&z,16+MAX_WBITS) != Z_OK)
+        throw std::runtime_error("could not initialize zlib for '"+name+"'");
+    }
+    virtual ~GzipStream() { inflateEnd(&z); }
+
+    virtual size_t read(char *dst, size_t size) override
+    {
+      size_t numRead = 0;
+      while (numRead < size) {
+        if (z.avail_in == 0) {
+          const size_t numIn = readRaw(in.data(),in.size());
+          if (numIn == 0) {
+            if (!memberDone)
+              throw std::runtime_error("unexpected end of compressed file '"+name+"'");
+            break;
+          }
+          z.next_in  = (Bytef *)in.data();
+          z.avail_in = (uInt)numIn;
+        }
+        z.next_out  = (Bytef *)dst+numRead;
+        z.avail_out = (uInt)std::min(size-numRead,(size_t)1<<30);
+        const uInt avail = z.avail_out;
+        const int rc = inflate(&z,Z_NO_FLUSH);
+        numRead += avail - z.avail_out;
+        if (rc == Z_STREAM_END) {
+          /* another member may follow */
+          memberDone = true;
+          inflateReset(&z);
+        } else if (rc == Z_OK)
+          memberDone = false;
+        else if (rc != Z_BUF_ERROR)
+          throw std::runtime_error("error decompressing '"+name+"': "
+                                   +(z.msg ? z.msg : "corrupt data"));
+      }
+      return numRead;
+    }
+
+    std::vector<char> in;
+    z_stream          z;
+    bool              memberDone;
+  };
+#endif
+
+#ifdef PBRT_PARSER_HAVE_ZSTD
+  /*! zstd-compressed data, possibly consisting of several frames */
+  struct ZstdStream : public FilterStream {
+    ZstdStream(std::unique_ptr<InputStream> &raw, const std::string &name,
+               const unsigned char *head, size_t headSize)
+      : FilterStream(raw,name,head,headSize),
+        in(std::max(ZSTD_DStreamInSize(),COMPRESSED_BUFFER_SIZE)),
+        zs(ZSTD_createDStream()), frameDone(false)
+    {
+      if (!zs || ZSTD_isError(ZSTD_initDStream(zs)))
+        throw std::runtime_error("could not initialize zstd for '"+name+"'");
+      input.src  = in.data();
+      input.size = 0;
+      input.pos  = 0;
+    }
+    virtual ~ZstdStream() { ZSTD_freeDStream(zs); }
+
+    virtual size_t read(char *dst, size_t size) override
+    {
+      ZSTD_outBuffer output = { dst, size, 0 };
+      while (output.pos < output.size) {
+        if (input.pos == input.size) {
+          const size_t numIn = readRaw(in.data(),in.size());
+          if (numIn == 0) {
+            if (!frameDone)
+              throw std::runtime_error("unexpected end of compressed file '"+name+"'");
+            break;
+          }
+          input.src  = in.data();
+          input.size = numIn;
+          input.pos  = 0;
+        }
+        const size_t rc = ZSTD_decompressStream(zs,&output,&input);
+        if (ZSTD_isError(rc))
+          throw std::runtime_error("error decompressing '"+name+"': "
+                                   +ZSTD_getErrorName(rc));
+        /* 0 means a frame is complete (another one may follow) */
+        frameDone = (rc == 0);
+      }
+      return output.pos;
+    }
+
+    std::vector<char> in;
+    ZSTD_inBuffer     input;
+    ZSTD_DStream     *zs;
+    bool              frameDone;
+  };
+#endif
+
+  /*! determine the format of the given raw stream, and put the
+    matching decompressor (if any) on top of it */
+  static std::unique_ptr<InputStream> decode(std::unique_ptr<InputStream> raw,
+                                             const std::string &name)
+  {
+    unsigned char head[4];
+    size_t headSize = 0;
+    while (headSize < sizeof(head)) {
+      const size_t numRead = raw->read((char *)head+headSize,sizeof(head)-headSize);
+      if (numRead == 0) break;
+      headSize += numRead;
+    }
+    switch (detectFormat(head,headSize)) {
+    case FORMAT_GZIP:
+#ifdef PBRT_PARSER_HAVE_ZLIB
+      return std::unique_ptr<InputStream>(new GzipStream(raw,name,head,headSize));
+#else
+      throw std::runtime_error("'"+name+"' is gzip-compressed, but the parser "
+                               "was built without zlib support");
+#endif
+    case FORMAT_ZSTD:
+#ifdef PBRT_PARSER_HAVE_ZSTD
+      return std::unique_ptr<InputStream>(new ZstdStream(raw,name,head,headSize));
+#else
+      throw std::runtime_error("'"+name+"' is zstd-compressed, but the parser "
+                               "was built without zstd support");
+#endif
+    default:
+      return std::unique_ptr<InputStream>(new PlainStream(raw,name,head,headSize));
+    }
+  }
+
+  std::unique_ptr<InputStream> openInputStream(const std::string &fileName)
+  {
+    FILE *file = fopen(fileName.c_str(),"rb");
+    if (!file)
+      throw std::runtime_error("could not open file '"+fileName+"'");
+    /* we do our own buffering */
+    setvbuf(file,nullptr,_IONBF,0);
+    return decode(std::unique_ptr<InputStream>(new StdioStream(file,fileName)),fileName);
+  }
+
+  std::unique_ptr<InputStream> openInputStream(const char *data, size_t size,
+                                               const std::string &name)
+  {
+    return decode(std::unique_ptr<InputStream>(new MemoryStream(data,size)),name);
+  }
+
+  std::unique_ptr<InputStream> openInputStream(std::istream &in,
+                                               const std::string &name)
+  {
+    return decode(std::unique_ptr<InputStream>(new StdStream(in,name)),name);
+  }
+
+} // ::pbrt_parser
@@ -0,0 +1,55 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+/*! \file InputStream.h the byte streams a (non-mapped) File reads
+    from: plain files, memory and std::istreams, plus in-process
+    decompression of gzip and zstd compressed data from any of those
+    (if built with zlib and libzstd, respectively) */
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <istream>
+
+namespace pbrt_parser {
+
+  /*! a stream of input bytes */
+  struct InputStream {
+    virtual ~InputStream() {}
+    /*! read up to 'size' bytes into 'dst'; returns the number of
+      bytes read, which is less than 'size' only at the end of the
+      stream. throws if the stream is broken */
+    virtual size_t read(char *dst, size_t size) = 0;
+  };
+
+  /*! returns true if the given first bytes of a file indicate a
+    compressed file */
+  bool isCompressed(const unsigned char *begin, size_t size);
+
+  /*! open given file as an input stream, transparently decompressing
+    it if it is a compressed one */
+  std::unique_ptr<InputStream> openInputStream(const std::string &fileName);
+  /*! same, for the given in-memory data (which does not get copied,
+    and has to stay around for as long as the stream does) */
+  std::unique_ptr<InputStream> openInputStream(const char *data, size_t size,
+                                               const std::string &name);
+  /*! same, for the given std::istream */
+  std::unique_ptr<InputStream> openInputStream(std::istream &in,
+                                               const std::string &name);
+
+} // ::pbrt_parser
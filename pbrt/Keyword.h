@@ -0,0 +1,169 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+/*! \file Keyword.h ids for the keywords of the pbrt file format, so
+    the parser can dispatch on an id rather than comparing strings.
+    tokens get classified once, by the lexer, through a
+    perfect hash over the keywords */
+
+#include <stdint.h>
+#include <string.h>
+
+namespace pbrt_parser {
+
+  typedef enum {
+    KEYWORD_NONE=0,
+    KEYWORD_ACCELERATOR,
+    KEYWORD_ACTIVE_TRANSFORM,
+    KEYWORD_AREA_LIGHT_SOURCE,
+    KEYWORD_ATTRIBUTE_BEGIN,
+    KEYWORD_ATTRIBUTE_END,
+    KEYWORD_CAMERA,
+    KEYWORD_CONCAT_TRANSFORM,
+    KEYWORD_COORD_SYS_TRANSFORM,
+    KEYWORD_FILM,
+    KEYWORD_IDENTITY,
+    KEYWORD_INCLUDE,
+    KEYWORD_INTEGRATOR,
+    KEYWORD_LIGHT_SOURCE,
+    KEYWORD_LOOK_AT,
+    KEYWORD_MAKE_NAMED_MATERIAL,
+    KEYWORD_MATERIAL,
+    KEYWORD_NAMED_MATERIAL,
+    KEYWORD_OBJECT_BEGIN,
+    KEYWORD_OBJECT_END,
+    KEYWORD_OBJECT_INSTANCE,
+    KEYWORD_PIXEL_FILTER,
+    KEYWORD_RENDERER,
+    KEYWORD_REVERSE_ORIENTATION,
+    KEYWORD_ROTATE,
+    KEYWORD_SAMPLER,
+    KEYWORD_SCALE,
+    KEYWORD_SHAPE,
+    KEYWORD_SURFACE_INTEGRATOR,
+    KEYWORD_TEXTURE,
+    KEYWORD_TRANSFORM,
+    KEYWORD_TRANSFORM_BEGIN,
+    KEYWORD_TRANSFORM_END,
+    KEYWORD_TRANSLATE,
+    KEYWORD_VOLUME,
+    KEYWORD_VOLUME_INTEGRATOR,
+    KEYWORD_WORLD_BEGIN,
+    KEYWORD_WORLD_END,
+    NUM_KEYWORDS
+  } Keyword;
+
+  /*! the keywords' names, by id */
+  constexpr const char *keywordNames[NUM_KEYWORDS] = {
+    "",
+    "Accelerator",
+    "ActiveTransform",
+    "AreaLightSource",
+    "AttributeBegin",
+    "AttributeEnd",
+    "Camera",
+    "ConcatTransform",
+    "CoordSysTransform",
+    "Film",
+    "Identity",
+    "Include",
+    "Integrator",
+    "LightSource",
+    "LookAt",
+    "MakeNamedMaterial",
+    "Material",
+    "NamedMaterial",
+    "ObjectBegin",
+    "ObjectEnd",
+    "ObjectInstance",
+    "PixelFilter",
+    "Renderer",
+    "ReverseOrientation",
+    "Rotate",
+    "Sampler",
+    "Scale",
+    "Shape",
+    "SurfaceIntegrator",
+    "Texture",
+    "Transform",
+    "TransformBegin",
+    "TransformEnd",
+    "Translate",
+    "Volume",
+    "VolumeIntegrator",
+    "WorldBegin",
+    "WorldEnd",
+  };
+
+  /*! perfect hash over the keywords (all of which are at least 4
+    chars long): no two of them map to the same slot in keywordTable */
+  constexpr inline uint32_t keywordHash(const char *s, size_t len)
+  {
+    return (uint32_t((unsigned char)s[0])
+            + 5*uint32_t((unsigned char)s[1])
+            + 4*uint32_t((unsigned char)s[len-1])
+            + 6*uint32_t(len)) & 127;
+  }
+
+  /*! keyword id by hash slot (KEYWORD_NONE for empty slots) */
+  constexpr uint8_t keywordTable[128] = {
+     0,  0,  0,  0,  0,  0,  0,  0,
+     8,  0,  0, 29,  0, 27,  0,  0,
+     0,  4, 16,  0,  0,  0,  0,  0,
+     0,  0, 31,  0,  0,  0,  0,  9,
+     0, 20,  0,  0,  0,  0,  0,  0,
+     0, 35, 25,  0,  0, 11,  0, 13,
+     0, 17,  0, 18,  0, 24,  0,  0,
+     0, 34,  1,  0,  0,  0,  2,  0,
+     0,  0, 37, 22,  0,  0,  0,  0,
+    15,  0, 28,  0,  0,  0,  0,  0,
+     6, 10,  0,  0,  0,  0,  0,  0,
+    33,  0,  0,  0,  0,  5,  0,  0,
+     0,  0,  0,  0,  0,  0, 32, 21,
+     0,  3,  0, 14,  0,  0,  0, 23,
+     0,  0,  0, 12, 26,  0, 36,  0,
+    30,  0,  0,  0,  7,  0,  0, 19,
+  };
+
+  constexpr inline size_t keywordLength(const char *s)
+  { return *s ? 1+keywordLength(s+1) : 0; }
+  constexpr inline bool keywordTableIsPerfect(int k=1)
+  {
+    return k == NUM_KEYWORDS
+      || (keywordTable[keywordHash(keywordNames[k],keywordLength(keywordNames[k]))] == k
+          && keywordTableIsPerfect(k+1));
+  }
+  static_assert(keywordTableIsPerfect(),
+                "keywordTable does not match keywordNames/keywordHash");
+
+  /*! returns the keyword the given text is, or KEYWORD_NONE if it is
+    none. all keywords start with an upper-case letter, so that's
+    the only thing numbers, parameter names etc ever get checked for */
+  inline Keyword findKeyword(const char *s, size_t len)
+  {
+    if (len < 4 || s[0] < 'A' || s[0] > 'Z')
+      return KEYWORD_NONE;
+    const int k = keywordTable[keywordHash(s,len)];
+    return (k != KEYWORD_NONE
+            && strncmp(keywordNames[k],s,len) == 0
+            && keywordNames[k][len] == 0)
+      ? (Keyword)k
+      : KEYWORD_NONE;
+  }
+
+} // ::pbrt_parser
@@ -15,49 +15,327 @@
 // ======================================================================== //
 
 #include "Lexer.h"
+#include "CharClass.h"
+#include "Number.h"
+#include "InputStream.h"
+#include "ospcommon/malloc.h"
 #include <sstream>
+#include <algorithm>
+#include <chrono>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+#ifndef _WIN32
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
 
 namespace pbrt_parser {
 
+  const CharClassTable charClassTable;
+
+  /*! default size and number of the read-ahead buffers for streamed
+    (non-mapped) files */
+  static const size_t FILE_BUFFER_SIZE  = 1<<20;
+  static const int    NUM_FILE_BUFFERS  = 4;
+  /*! size of the chunks a mapped file gets split into for parallel
+    lexing */
+  static const size_t PARALLEL_CHUNK_SIZE = 1<<22;
+  /*! how far past its bound a chunk's lexer looks for a new line to
+    start at */
+  static const size_t RESYNC_SCAN_SIZE = 1<<10;
+  /*! granularity of the newline index for mapped files */
+  static const size_t LINE_INDEX_BLOCK_SIZE = 1<<20;
+
+  /*! count the number of '\n's in [begin,end) */
+  static size_t countNewlines(const char *begin, const char *end)
+  {
+    size_t count = 0;
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (;begin+16 <= end; begin += 16) {
+      const __m128i chars = _mm_loadu_si128((const __m128i*)begin);
+      count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chars,nl)));
+    }
+#endif
+    for (;begin < end; ++begin)
+      count += (*begin == '\n');
+    return count;
+  }
+
+  // =======================================================
+  // config
+  // =======================================================
+  LexerConfig::LexerConfig()
+    : mapped(true), numThreads(1),
+      readBufferSize(FILE_BUFFER_SIZE), numReadBuffers(NUM_FILE_BUFFERS)
+  {}
+  
   // =======================================================
   // file
   // =======================================================
-  File::File(const FileName &fn)
-    : name(fn)
+  File::File(const FileName &fn, size_t bufferSize)
+    : name(fn), mappedData(nullptr), mappedSize(0), mappedDone(false), ownsMapping(false),
+      bufferSize(std::max(bufferSize,(size_t)1)),
+      numFilled(0), numHandedOut(0), readerDone(false), readerStop(false),
+      secondsBlocked(0), numBytesRead(0)
+  {}
+  
+  File::File(const FileName &fn, const LexerConfig &config)
+    : File(fn,config.readBufferSize)
+  {
+#ifndef _WIN32
+    if (config.mapped) {
+      int fd = open(fn.str().c_str(),O_RDONLY);
+      if (fd < 0)
+        throw std::runtime_error("could not open file '"+fn.str()+"'");
+      struct stat st;
+      if (fstat(fd,&st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *mem = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (mem != MAP_FAILED) {
+          if (isCompressed((const unsigned char *)mem,std::min((size_t)st.st_size,(size_t)4)))
+            munmap(mem,st.st_size);
+          else {
+            mappedData  = (char *)mem;
+            mappedSize  = st.st_size;
+            ownsMapping = true;
+            madvise(mem,mappedSize,MADV_SEQUENTIAL);
+          }
+        }
+      }
+      ::close(fd);
+      if (mappedData)
+        return;
+      /* not a regular file, compressed, or mapping failed - fall back
+         to reading it as a stream */
+    }
+#endif
+    startReading(openInputStream(fn.str()),config);
+  }
+
+  File::File(const std::string &name, const char *data, size_t size,
+             const LexerConfig &config)
+    : File(name,config.readBufferSize)
+  {
+    if (!isCompressed((const unsigned char *)data,std::min(size,(size_t)4))) {
+      /* plain text: use it in-place, just like a mapped file */
+      mappedData = (char *)data;
+      mappedSize = size;
+      return;
+    }
+    startReading(openInputStream(data,size,name),config);
+  }
+
+  File::File(const std::string &name, std::istream &in,
+             const LexerConfig &config)
+    : File(name,config.readBufferSize)
+  {
+    startReading(openInputStream(in,name),config);
+  }
+
+  void File::startReading(std::unique_ptr<InputStream> stream,
+                          const LexerConfig &config)
   {
-    file = fopen(fn.str().c_str(),"r");
-    if (!file)
-      throw std::runtime_error("could not open file '"+fn.str()+"'");
+    this->stream = std::move(stream);
+    buffers.resize(std::max(config.numReadBuffers,3));
+    for (size_t i=0;i<buffers.size();i++) {
+      buffers[i].data = (char *)ospcommon::alignedMalloc(bufferSize,4096);
+      buffers[i].size = 0;
+    }
+    reader = std::thread([this]() { readAhead(); });
+  }
+
+  void File::readAhead()
+  {
+    std::unique_lock<std::mutex> lock(readerMutex);
+    while (1) {
+      /* wait until the lexer let go of the buffer we're to fill next */
+      while (!readerStop && numFilled >= oldestHeld()+buffers.size())
+        readerCond.wait(lock);
+      if (readerStop)
+        break;
+      
+      Buffer &buf = buffers[numFilled % buffers.size()];
+      lock.unlock();
+      try {
+        buf.size = stream->read(buf.data,bufferSize);
+      } catch (const std::exception &e) {
+        readerError = e.what();
+        buf.size = 0;
+      }
+      lock.lock();
+      if (buf.size == 0)
+        break;
+      ++numFilled;
+      readerCond.notify_all();
+    }
+    readerDone = true;
+    readerCond.notify_all();
+  }
+
+  void File::stopReading()
+  {
+    if (!reader.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(readerMutex);
+      readerStop = true;
+    }
+    readerCond.notify_all();
+    reader.join();
+  }
+  
+  void File::close()
+  {
+    /* note we keep the mapping (and read buffers) alive until the
+       file itself dies: tokens and locs may still refer to them */
+    stopReading();
+    stream.reset();
   }
 
   File::~File()
   { 
-    if (file) fclose(file);
+    stopReading();
+    for (size_t i=0;i<buffers.size();i++)
+      ospcommon::alignedFree(buffers[i].data);
+#ifndef _WIN32
+    if (ownsMapping) munmap(mappedData,mappedSize);
+#endif
   }
 
+  bool File::read(const char *&begin, const char *&end)
+  {
+    if (mappedData) {
+      if (mappedDone) return false;
+      mappedDone = true;
+      begin = mappedData;
+      end   = mappedData+mappedSize;
+      return true;
+    }
+    if (buffers.empty())
+      return false;
+    
+    {
+      std::unique_lock<std::mutex> lock(readerMutex);
+      if (numFilled == numHandedOut && !readerDone) {
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        while (numFilled == numHandedOut && !readerDone)
+          readerCond.wait(lock);
+        secondsBlocked
+          += std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+      }
+      if (numFilled == numHandedOut) {
+        if (!readerError.empty())
+          throw std::runtime_error(readerError);
+        return false;
+      }
+      ++numHandedOut;
+    }
+    /* this released the buffer before the previous one */
+    readerCond.notify_all();
 
-  // =======================================================
-  // loc
-  // =======================================================
+    const Buffer &buf = buffers[(numHandedOut-1) % buffers.size()];
+    begin = buf.data;
+    end   = buf.data+buf.size;
 
-  //! constructor
-  Loc::Loc(std::shared_ptr<File> file) : file(file), line(1), col(0) 
+    std::lock_guard<std::mutex> lock(blocksMutex);
+    Block block;
+    block.offset      = numBytesRead;
+    block.linesBefore = 0;
+    if (!blocks.empty()) {
+      const Buffer &prev = buffers[(numHandedOut-2) % buffers.size()];
+      block.linesBefore = blocks.back().linesBefore
+        + countNewlines(prev.data,prev.data+prev.size);
+    }
+    blocks.push_back(block);
+    numBytesRead += buf.size;
+    return true;
+  }
+
+  /*! find the last '\n' in [begin,end), or nullptr if there is none */
+  static const char *findLastNewline(const char *begin, const char *end)
   {
-    assert(file);
+    while (end > begin)
+      if (*--end == '\n') return end;
+    return nullptr;
   }
-    
-  //! copy-constructor
-  Loc::Loc(const Loc &loc) : file(loc.file), line(loc.line), col(loc.col) 
+
+  bool File::getLineAndCol(size_t offset, int &line, int &col) const
   {
-    assert(loc.file);
+    std::lock_guard<std::mutex> lock(blocksMutex);
+    if (mappedData) {
+      if (offset >= mappedSize)
+        return false;
+      while (blocks.size()*LINE_INDEX_BLOCK_SIZE <= offset) {
+        Block block;
+        block.offset      = blocks.size()*LINE_INDEX_BLOCK_SIZE;
+        block.linesBefore = blocks.empty() ? 0 : blocks.back().linesBefore
+          + countNewlines(mappedData+blocks.back().offset,mappedData+block.offset);
+        blocks.push_back(block);
+      }
+      const Block &block = blocks[offset / LINE_INDEX_BLOCK_SIZE];
+      const char *c  = mappedData+offset;
+      const char *nl = findLastNewline(mappedData,c);
+      line = int(1 + block.linesBefore + countNewlines(mappedData+block.offset,c));
+      col  = int(nl ? c-nl : c-mappedData+1);
+      return true;
+    }
+
+    /* streamed file: only the last two blocks are still in memory */
+    const size_t numBlocks = blocks.size();
+    if (numBlocks == 0 || offset >= numBytesRead)
+      return false;
+    const size_t blockID = (offset >= blocks[numBlocks-1].offset) ? numBlocks-1 : numBlocks-2;
+    if (offset < blocks[blockID].offset)
+      return false;
+
+    const bool  inCurrent  = (blockID == numBlocks-1);
+    const char *blockBegin = buffers[blockID % buffers.size()].data;
+    const char *c          = blockBegin+(offset-blocks[blockID].offset);
+    line = int(1 + blocks[blockID].linesBefore + countNewlines(blockBegin,c));
+
+    if (const char *nl = findLastNewline(blockBegin,c)) {
+      col = int(c-nl);
+      return true;
+    }
+    if (blockID == 0) {
+      col = int(c-blockBegin+1);
+      return true;
+    }
+    /* line started in a previous block; if that one's still in
+       memory we can compute the column, else we leave it unknown */
+    col = 0;
+    if (!inCurrent)
+      return true;
+    const char *prevBegin = buffers[(blockID-1) % buffers.size()].data;
+    const char *prevEnd   = prevBegin+(blocks[blockID].offset-blocks[blockID-1].offset);
+    if (const char *nl = findLastNewline(prevBegin,prevEnd)) {
+      col = int((prevEnd-nl)+(c-blockBegin));
+      return true;
+    }
+    if (blockID-1 == 0)
+      col = int((prevEnd-prevBegin)+(c-blockBegin)+1);
+    return true;
   }
-    
+
+  // =======================================================
+  // loc
+  // =======================================================
+
   //! pretty-print
   std::string Loc::toString() const 
   {
     std::stringstream ss;
     assert(file);
-    ss << "@" << file->getFileName() << ":" << line << "." << col;
+    int line, col;
+    if (!file->getLineAndCol(offset,line,col))
+      ss << "@" << file->getFileName() << ":<byte " << offset << ">";
+    else if (col == 0)
+      ss << "@" << file->getFileName() << ":" << line;
+    else
+      ss << "@" << file->getFileName() << ":" << line << "." << col;
     return ss.str();
   }
 
@@ -68,15 +346,17 @@ namespace pbrt_parser {
   //! constructor
   Token::Token(const Loc &loc, 
                const Type type,
-               const std::string &text) 
-    : loc(loc), type(type), text(text) 
+               const TextView &text) 
+    : type(type),
+      keyword(findKeyword(text.begin,text.size)),
+      text(text), loc(loc)
   {}
 
   //! pretty-print
   std::string Token::toString() const 
   {
     std::stringstream ss;
-    ss << loc.toString() <<": " << text;
+    ss << loc.toString() <<": " << text.str();
     return ss.str();
   }
     
@@ -85,140 +365,536 @@ namespace pbrt_parser {
   // =======================================================
 
   //! constructor
-  Lexer::Lexer(const FileName &fn)
-    : file(new File(fn)), loc(file), peekedChar(-1) 
+  Lexer::Lexer(const FileName &fn, const LexerConfig &config)
+    : Lexer(std::make_shared<File>(fn,config),config)
+  {}
+
+  Lexer::Lexer(const std::string &name, const char *data, size_t size,
+               const LexerConfig &config)
+    : Lexer(std::make_shared<File>(name,data,size,config),config)
+  {}
+
+  Lexer::Lexer(const std::string &name, std::istream &in,
+               const LexerConfig &config)
+    : Lexer(std::make_shared<File>(name,in,config),config)
+  {}
+
+  Lexer::Lexer(const std::shared_ptr<File> &file, const LexerConfig &config)
+    : numThreads(config.numThreads),
+      numBatchesStarted(0), numWorkersBusy(0), workersStop(false),
+      numProduced(0), numConsumed(0),
+      file(file),
+      pos(nullptr), end(nullptr), windowBegin(nullptr), windowOffset(0),
+      tokenBegin(nullptr), tokenSlot(0)
   {
+    if (this->numThreads <= 0)
+      this->numThreads = std::max(1,(int)std::thread::hardware_concurrency());
+    if (!file->isMapped())
+      this->numThreads = 1;
+    current.chunkID = current.tokenID = 0;
+    if (this->numThreads > 1) {
+      for (int i=0;i<this->numThreads;i++)
+        workers.push_back(std::thread([this,i]() { lexAhead(i); }));
+      startBatch(pending,0);
+    }
   }
 
-  /*! produce the next token from the input stream; return nullptr if
-    end of (all files) is reached */
-  inline std::shared_ptr<Token> Lexer::produceNextToken() 
+  Lexer::~Lexer()
   {
-    // skip all white space and comments
-    int c;
+    {
+      std::lock_guard<std::mutex> lock(workerMutex);
+      workersStop = true;
+    }
+    workerCond.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
 
-    std::stringstream ss;
+  inline Lexer::MappedToken Lexer::lexMappedToken(const char *&pos, Token &token) const
+  {
+    const char *data = file->mappedData;
+    const char *end  = data + file->mappedSize;
+    while (1) {
+      pos = skipWhite(pos,end);
+      if (pos == end)
+        return MAPPED_END;
+      if (*pos != '#')
+        break;
+      pos = findChar(pos,end,'\n');
+    }
+    const Loc loc(file.get(),pos - data);
+    if (*pos == '"') {
+      const char *tokenBegin = ++pos;
+      pos = findChar(pos,end,'"');
+      if (pos == end) {
+        token.loc = loc;
+        return MAPPED_OPEN_STRING;
+      }
+      token = Token(loc,Token::TOKEN_TYPE_STRING,TextView(tokenBegin,pos++));
+      return MAPPED_TOKEN;
+    }
+    if (isSpecial(*pos)) {
+      token = Token(loc,Token::TOKEN_TYPE_SPECIAL,TextView(pos,pos+1));
+      ++pos;
+      return MAPPED_TOKEN;
+    }
+    const char *tokenBegin = pos;
+    pos = findDelimiter(pos,end);
+    token = Token(loc,Token::TOKEN_TYPE_LITERAL,TextView(tokenBegin,pos));
+    return MAPPED_TOKEN;
+  }
 
-    Loc startLoc = loc;
-    // skip all whitespaces and comments
+  void Lexer::lexChunk(Chunk &chunk, size_t begin, size_t stop, bool resync) const
+  {
+    const char *end = file->mappedData + file->mappedSize;
+    const char *pos = file->mappedData + begin;
+    if (resync) {
+      /* a new line is the likeliest place to be outside of strings and
+         comments. if there's none close by, though (say, in a long
+         list of numbers) skip to the end of the current literal
+         instead, so we don't leave all of that to the merge */
+      const char *limit = std::min(end,pos+RESYNC_SCAN_SIZE);
+      const char *newline = findChar(pos,limit,'\n');
+      pos = (newline < limit) ? newline : findDelimiter(pos,end);
+    }
+
+    chunk.tokens.clear();
+    chunk.complete = true;
+    Token token;
     while (1) {
-      c = get_char();
+      const MappedToken result = lexMappedToken(pos,token);
+      if (result == MAPPED_END) {
+        chunk.next = file->mappedSize;
+        return;
+      }
+      chunk.next = token.loc.offset;
+      if (chunk.next >= stop)
+        return;
+      if (result == MAPPED_OPEN_STRING) {
+        chunk.complete = false;
+        return;
+      }
+      chunk.tokens.push_back(token);
+    }
+  }
+
+  void Lexer::resyncChunk(Chunk &chunk, std::vector<ChunkToken> &before,
+                          size_t next, size_t stop) const
+  {
+    const char *pos = file->mappedData + next;
+    std::vector<ChunkToken>::const_iterator it = chunk.tokens.begin();
+    Token token;
+    while (1) {
+      const MappedToken result = lexMappedToken(pos,token);
+      const size_t offset = (result == MAPPED_END) ? file->mappedSize : token.loc.offset;
+      if (result == MAPPED_END || offset >= stop || result == MAPPED_OPEN_STRING) {
+        /* never got in sync: what we lexed is all there is */
+        chunk.first    = chunk.tokens.size();
+        chunk.next     = offset;
+        chunk.complete = (result != MAPPED_OPEN_STRING || offset >= stop);
+        return;
+      }
+      while (it != chunk.tokens.end() && it->offset < offset)
+        ++it;
+      if (it != chunk.tokens.end() && it->offset == offset) {
+        /* both lexers are at the same token boundary, so from here on
+           they agree - including on where the chunk ends */
+        chunk.first = it - chunk.tokens.begin();
+        return;
+      }
+      before.push_back(token);
+    }
+  }
 
-      if (c < 0) { file->close(); return std::shared_ptr<Token>(); }
-          
-      if (isWhite(c)) {
+  void Lexer::lexAhead(size_t workerID)
+  {
+    size_t numBatchesDone = 0;
+    std::unique_lock<std::mutex> lock(workerMutex);
+    while (1) {
+      workerCond.wait(lock,[&]() { return workersStop || numBatchesStarted > numBatchesDone; });
+      if (workersStop)
+        return;
+      numBatchesDone = numBatchesStarted;
+      lock.unlock();
+      /* the parser doesn't touch the pending batch until we're done */
+      if (workerID < pending.chunks.size())
+        lexChunk(pending.chunks[workerID],pending.bounds[workerID],
+                 pending.bounds[workerID+1],workerID > 0);
+      lock.lock();
+      if (--numWorkersBusy == 0)
+        batchDoneCond.notify_one();
+    }
+  }
+
+  void Lexer::startBatch(Batch &batch, size_t begin)
+  {
+    const size_t size = file->mappedSize;
+    batch.bounds.clear();
+    batch.chunkID = batch.tokenID = 0;
+    if (begin >= size) {
+      batch.chunks.clear();
+      return;
+    }
+    
+    batch.bounds.push_back(begin);
+    for (int i=0;i<numThreads && batch.bounds.back() < size;i++)
+      batch.bounds.push_back(std::min(size,batch.bounds.back()+PARALLEL_CHUNK_SIZE));
+    /* (re-)using the chunks' token vectors of previous batches, so
+       we don't have to fault in fresh memory for each */
+    batch.chunks.resize(batch.bounds.size()-1);
+    {
+      std::lock_guard<std::mutex> lock(workerMutex);
+      ++numBatchesStarted;
+      numWorkersBusy = workers.size();
+    }
+    workerCond.notify_all();
+  }
+
+  size_t Lexer::finishBatch(Batch &batch)
+  {
+    {
+      std::unique_lock<std::mutex> lock(workerMutex);
+      batchDoneCond.wait(lock,[this]() { return numWorkersBusy == 0; });
+    }
+
+    /* 'next' is where the previous chunk's last token ended, which is
+       where a sequential lexer would continue. the chunk's own
+       (speculative) lexer started a bit past the chunk's bound, so
+       usually missed a few tokens; lex those sequentially,
+       appending them to the chunk that precedes, until both lexers
+       meet */
+    size_t next = batch.bounds[0];
+    Chunk *before = nullptr;
+    for (size_t i=0;i<batch.chunks.size();i++) {
+      Chunk &chunk = batch.chunks[i];
+      chunk.first = chunk.tokens.size();
+      if (next >= batch.bounds[i+1]) {
+        /* covered by the previous chunk's last token */
+        chunk.complete = true;
         continue;
       }
-          
-      if (c == '#') {
-        startLoc = loc;
-        Loc lastLoc = loc;
-        // std::cout << "start of comment at " << startLoc.toString() << std::endl;
-        while (c != '\n') {
-          lastLoc = loc;
-          c = get_char();
-          if (c < 0) return std::shared_ptr<Token>();
+      if (before)
+        resyncChunk(chunk,before->tokens,next,batch.bounds[i+1]);
+      else
+        /* lexed right from 'next' */
+        chunk.first = 0;
+      before = &chunk;
+      if (!chunk.complete) {
+        /* a string that does not end; this gets reported once the
+           parser got there. nothing after this */
+        for (size_t j=i+1;j<batch.chunks.size();j++) {
+          batch.chunks[j].first    = batch.chunks[j].tokens.size();
+          batch.chunks[j].complete = true;
         }
-        // std::cout << "END of comment at " << lastLoc.toString() << std::endl;
+        next = file->mappedSize;
+        break;
+      }
+      next = chunk.next;
+    }
+    batch.chunkID = 0;
+    batch.tokenID = batch.chunks.empty() ? 0 : batch.chunks[0].first;
+    return next;
+  }
+
+  inline void Lexer::produceNextBatchToken(Token &token)
+  {
+    while (1) {
+      while (current.chunkID < current.chunks.size()) {
+        const Chunk &chunk = current.chunks[current.chunkID];
+        if (current.tokenID < chunk.tokens.size()) {
+          const ChunkToken &chunkToken = chunk.tokens[current.tokenID++];
+          const char *begin = file->mappedData + chunkToken.offset
+            + (chunkToken.type == Token::TOKEN_TYPE_STRING);
+          token.type    = (Token::Type)chunkToken.type;
+          token.keyword = (Keyword)chunkToken.keyword;
+          token.text    = TextView(begin,begin+chunkToken.size);
+          token.loc     = Loc(file.get(),chunkToken.offset);
+          return;
+        }
+        if (!chunk.complete)
+          THROW_RUNTIME_ERROR("could not find end of string literal (found eof instead)");
+        if (++current.chunkID < current.chunks.size())
+          current.tokenID = current.chunks[current.chunkID].first;
+      }
+      if (pending.chunks.empty()) {
+        token = Token();
+        return;
+      }
+      /* the parser is done with the current batch; make the pending
+         one current, and get the workers going on the one after that */
+      const size_t next = finishBatch(pending);
+      std::swap(current,pending);
+      startBatch(pending,next);
+    }
+  }
+
+  inline void Lexer::makeToken(Token &token,
+                               const Token::Type type,
+                               const char *tokenEnd)
+  {
+    const char *begin = tokenBegin;
+    tokenBegin = nullptr;
+
+    TextView text(begin,tokenEnd);
+    if (!file->isMapped()) {
+      /* the current window will get overwritten by the next read, so
+         save the token's text in the ring */
+      std::string &storage = ringText[tokenSlot];
+      storage.append(begin,tokenEnd);
+      text = TextView(storage.data(),storage.data()+storage.size());
+    }
+    token.type    = type;
+    token.keyword = findKeyword(text.begin,text.size);
+    token.text    = text;
+  }
+
+  /*! produce the next token from the input stream; produce an
+    end-of-input token if end of (all files) is reached */
+  inline void Lexer::produceNextToken(Token &token) 
+  {
+    if (numThreads > 1) {
+      produceNextBatchToken(token);
+      return;
+    }
+    token = Token();
+    ringText[tokenSlot].clear();
+
+    // skip all whitespaces and comments
+    while (1) {
+      pos = skipWhite(pos,end);
+      if (pos == end) {
+        if (!refill()) { file->close(); return; }
+        continue;
+      }
+      if (*pos == '#') {
+        while ((pos = findChar(pos,end,'\n')) == end)
+          if (!refill()) return;
         continue;
       }
       break;
     }
 
-    startLoc = loc;
-    Loc lastLoc = loc;
-    if (c == '"') {
-      // cout << "START OF STRING at " << loc.toString() << endl;
-      while (1) {
-        lastLoc = loc;
-        c = get_char();
-        if (c < 0)
+    token.loc = Loc(file.get(),windowOffset + (pos - windowBegin));
+    // -------------------------------------------------------
+    // string
+    // -------------------------------------------------------
+    if (*pos == '"') {
+      tokenBegin = ++pos;
+      while ((pos = findChar(pos,end,'"')) == end)
+        if (!refill())
           THROW_RUNTIME_ERROR("could not find end of string literal (found eof instead)");
-        if (c == '"') 
-          break;
-        ss << (char)c;
-      } 
-      return std::make_shared<Token>(startLoc,Token::TOKEN_TYPE_STRING,ss.str());
+      makeToken(token,Token::TOKEN_TYPE_STRING,pos++);
+      return;
     }
 
     // -------------------------------------------------------
     // special char
     // -------------------------------------------------------
-    if (isSpecial(c)) {
-      ss << (char)c;
-      return std::make_shared<Token>(startLoc,Token::TOKEN_TYPE_SPECIAL,ss.str());
+    tokenBegin = pos++;
+    if (isSpecial(*tokenBegin)) {
+      makeToken(token,Token::TOKEN_TYPE_SPECIAL,pos);
+      return;
     }
 
-    ss << (char)c;
-    // cout << "START OF TOKEN at " << loc.toString() << endl;
-    while (1) {
-      lastLoc = loc;
-      c = get_char();
-      if (c < 0)
-        return std::make_shared<Token>(startLoc,Token::TOKEN_TYPE_LITERAL,ss.str());
-      if (c == '#' || isSpecial(c) || isWhite(c) || c=='"') {
-        // cout << "END OF TOKEN AT " << lastLoc.toString() << endl;
-        unget_char(c);
-        return std::make_shared<Token>(startLoc,Token::TOKEN_TYPE_LITERAL,ss.str());
-      }
-      ss << (char)c;
-    }
+    // -------------------------------------------------------
+    // literal: everything up to the next delimiter
+    // -------------------------------------------------------
+    while ((pos = findDelimiter(pos,end)) == end)
+      if (!refill()) break;
+    makeToken(token,Token::TOKEN_TYPE_LITERAL,pos);
   }
 
-  std::shared_ptr<Token> Lexer::peek(size_t i)
+  Token Lexer::peek(size_t i)
   {
-    while (i >= peekedTokens.size())
-      peekedTokens.push_back(produceNextToken());
-    return peekedTokens[i];
+    if (i >= RING_SIZE-1)
+      THROW_RUNTIME_ERROR("can't peek that far ahead");
+    while (numConsumed+i >= numProduced) {
+      tokenSlot = numProduced % RING_SIZE;
+      produceNextToken(ring[tokenSlot]);
+      ++numProduced;
+    }
+    return ring[(numConsumed+i) % RING_SIZE];
   }
       
-  inline void Lexer::unget_char(int c)
+  inline bool Lexer::refill()
   {
-    if (peekedChar >= 0) 
-      THROW_RUNTIME_ERROR("can't push back more than one char ...");
-    peekedChar = c;
+    if (tokenBegin && !file->isMapped()) {
+      ringText[tokenSlot].append(tokenBegin,pos);
+      tokenBegin = pos;
+    }
+    windowOffset += (end - windowBegin);
+    windowBegin   = end;
+    if (!file->read(pos,end))
+      return false;
+    windowBegin = pos;
+    if (tokenBegin) 
+      tokenBegin = pos;
+    return true;
   }
 
-  inline int Lexer::get_char() 
+  inline void scanNumber(const char *begin, const char *end, float &value)
+  { scanFloat(begin,end,value); }
+  inline void scanNumber(const char *begin, const char *end, int &value)
+  { scanInt(begin,end,value); }
+
+  template<typename T>
+  inline bool Lexer::readNumbersT(AlignedVector<T> &values)
   {
-    if (peekedChar >= 0) {
-      int c = peekedChar;
-      peekedChar = -1;
-      return c;
-    }
-        
-    if (!file->file || feof(file->file)) {
-      return -1;
+    /* tokens that were already peeked go first; and with parallel
+       lexing all numbers already are tokens */
+    while (numConsumed < numProduced || numThreads > 1) {
+      if (numConsumed == numProduced && current.chunkID < current.chunks.size()) {
+        /* decode what the current chunk has straight from its tokens,
+           without going through the ring */
+        const Chunk &chunk = current.chunks[current.chunkID];
+        for (;current.tokenID < chunk.tokens.size();current.tokenID++) {
+          const ChunkToken &chunkToken = chunk.tokens[current.tokenID];
+          if (chunkToken.type != Token::TOKEN_TYPE_LITERAL) break;
+          const char *begin = file->mappedData + chunkToken.offset;
+          T value;
+          scanNumber(begin,begin+chunkToken.size,value);
+          values.push_back(value);
+        }
+      }
+      const Token token = peek();
+      if (token.type != Token::TOKEN_TYPE_LITERAL) {
+        if (token.text != "]") return false;
+        ++numConsumed;
+        return true;
+      }
+      T value;
+      scanNumber(token.text.begin,token.text.end(),value);
+      values.push_back(value);
+      ++numConsumed;
     }
-        
-    int c = fgetc(file->file);
-    int eol = '\n';
-    if (c == '\n') {
-      loc.line++;
-      loc.col = 0;
-    } else {
-      loc.col++;
+
+    /* if the whole list is in the current window, do a quick scan to
+       pre-size the output */
+    const char *close = findChar(pos,end,']');
+    if (close != end)
+      values.reserve(values.size()+countWords(pos,close));
+    
+    while (1) {
+      pos = skipWhite(pos,end);
+      if (pos == end) {
+        if (!refill()) return false;
+        continue;
+      }
+      if (*pos == ']') {
+        ++pos;
+        return true;
+      }
+      if (*pos == '#') {
+        while ((pos = findChar(pos,end,'\n')) == end)
+          if (!refill()) return false;
+        continue;
+      }
+      if (isDelimiter(*pos))
+        /* a string, or some other special char */
+        return false;
+
+      const char *numberEnd = findDelimiter(pos,end);
+      T value;
+      if (numberEnd == end) {
+        /* this number might continue in the next window - let the
+           regular token code handle this one */
+        const Token token = next();
+        scanNumber(token.text.begin,token.text.end(),value);
+      } else {
+        scanNumber(pos,numberEnd,value);
+        pos = numberEnd;
+      }
+      values.push_back(value);
     }
-    return c;
-  };
-      
-  inline bool Lexer::isWhite(const char c)
+  }
+
+  bool Lexer::readNumbers(AlignedVector<float> &values)
+  { return readNumbersT(values); }
+
+  bool Lexer::readNumbers(AlignedVector<int> &values)
+  { return readNumbersT(values); }
+
+  bool Lexer::skipNumbers(TextView &text, size_t minSize)
+  {
+    if (!file->isMapped() || numThreads > 1 || numConsumed < numProduced)
+      return false;
+    /* anything but white space and literals before the closing ']'
+       (comments, strings, ...) needs the regular tokens */
+    const char *close = findSpecial(pos,end);
+    if (close == end || *close != ']' || (size_t)(close-pos) < minSize)
+      return false;
+    text = TextView(pos,close);
+    pos  = close+1;
+    return true;
+  }
+
+  inline void Lexer::skipChars()
   {
-    return strchr(" \t\n\r",c)!=nullptr;
+    int depth = 0;
+    while (1) {
+      pos = (depth > 0) ? findSpecial(pos,end) : skipWhite(pos,end);
+      if (pos == end) {
+        if (!refill()) return;
+        continue;
+      }
+      switch (*pos) {
+      case '#':
+        while ((pos = findChar(pos,end,'\n')) == end)
+          if (!refill()) return;
+        break;
+      case '"':
+        ++pos;
+        while ((pos = findChar(pos,end,'"')) == end)
+          if (!refill())
+            THROW_RUNTIME_ERROR("could not find end of string literal (found eof instead)");
+        ++pos;
+        break;
+      case '[':
+        ++depth;
+        ++pos;
+        break;
+      case ']':
+        depth = std::max(depth-1,0);
+        ++pos;
+        break;
+      case ',':
+        ++pos;
+        break;
+      default:
+        /* a literal outside of brackets: might be the next keyword */
+        return;
+      }
+    }
   }
-  inline bool Lexer::isSpecial(const char c)
+
+  void Lexer::skipStatement()
   {
-    return strchr("[,]",c)!=nullptr;
+    while (1) {
+      if (numConsumed == numProduced && numThreads == 1)
+        skipChars();
+      const Token token = peek();
+      if (!token || (token.type == Token::TOKEN_TYPE_LITERAL && token.keyword != KEYWORD_NONE))
+        return;
+      ++numConsumed;
+    }
   }
 
-  std::shared_ptr<Token> Lexer::next() 
+  Token Lexer::next() 
   {
-    if (peekedTokens.empty())
-      return produceNextToken();
-      
-    std::shared_ptr<Token> token = peekedTokens.front();
-    peekedTokens.pop_front();
-    return token;
+    if (numConsumed == numProduced && numThreads > 1) {
+      /* nothing peeked, so no need to go through the ring */
+      Token token;
+      produceNextBatchToken(token);
+      ++numProduced;
+      ++numConsumed;
+      return token;
+    }
+    if (numConsumed == numProduced) {
+      tokenSlot = numProduced % RING_SIZE;
+      produceNextToken(ring[tokenSlot]);
+      ++numProduced;
+    }
+    return ring[numConsumed++ % RING_SIZE];
   }
 
 } // ::pbrt_parser
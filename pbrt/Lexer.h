@@ -17,62 +17,191 @@
 #pragma once
 
 #include "pbrt/pbrt.h"
+#include "pbrt/Keyword.h"
+#include "pbrt/AlignedVector.h"
 // stl
 #include <queue>
 #include <memory>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <istream>
 
 namespace pbrt_parser {
 
-  /*! file name and handle, to be used by tokenizer and loc */
+  /*! how the lexer reads (and tokenizes) its input files */
+  struct PBRT_PARSER_INTERFACE LexerConfig {
+    LexerConfig();
+
+    /*! memory-map input files where possible; files that can't be
+      mapped (pipes, etc) get streamed */
+    bool   mapped;
+    /*! number of threads to lex mapped files with: 1 lexes
+      sequentially, 0 uses all cores. the lexing threads come on top
+      of the parser's own, so this only pays off with spare cores */
+    int    numThreads;
+    /*! size and number (at least 3) of the buffers a streamed file
+      gets read ahead into by a background thread */
+    size_t readBufferSize;
+    int    numReadBuffers;
+  };
+
+  struct InputStream;
+
+  /*! file name and handle, to be used by tokenizer and loc. Unless
+    asked otherwise, the file's content gets memory-mapped as a
+    whole, so the lexer can scan (and tokens can refer to) the file's
+    bytes directly; if mapping is not requested (or not possible) the
+    file gets read through a stream instead, by a background thread
+    that reads ahead while the lexer works on the previous buffers.
+    gzip and zstd compressed files get recognized by their content,
+    and decompressed on the fly (on that same thread) */
   struct PBRT_PARSER_INTERFACE File {
-    File(const FileName &fn);
-    void close() { fclose(file); file = NULL; }
+    File(const FileName &fn, const LexerConfig &config=LexerConfig());
+    /*! a 'file' of given name whose content is the given in-memory
+      data. the data does not get copied; it has to stay valid for
+      as long as the file (and the tokens read from it) are around */
+    File(const std::string &name, const char *data, size_t size,
+         const LexerConfig &config=LexerConfig());
+    /*! a 'file' of given name whose content gets read from the given
+      stream (on the read-ahead thread) */
+    File(const std::string &name, std::istream &in,
+         const LexerConfig &config=LexerConfig());
+    /*! close the input stream; a mapping stays valid until the file
+      itself gets destroyed */
+    void close();
     virtual ~File();
     /*! get name of the file */
     std::string getFileName() const { return name; }
+    /*! returns whether the whole file content is mapped into memory */
+    bool isMapped() const { return mappedData != nullptr; }
+    /*! time (in seconds) the lexer had to wait for the read-ahead
+      thread to deliver input */
+    double getSecondsBlocked() const { return secondsBlocked; }
+
+    /*! compute (1-based) line and column of the char at given byte
+      offset. this is meant for error messages only, and gets
+      computed lazily from a newline index. returns false if the
+      given part of a streamed file is no longer in memory; col is 0
+      if the start of that line no longer is */
+    bool getLineAndCol(size_t offset, int &line, int &col) const;
 
     friend class Lexer;
 
   private:
+    /*! common part of the constructors: sets up an empty file */
+    File(const FileName &fn, size_t bufferSize);
+    /*! start reading the given stream on the read-ahead thread */
+    void startReading(std::unique_ptr<InputStream> stream, const LexerConfig &config);
+
+    /*! get the next block of input chars. for a mapped file this is
+      the entire file, for streamed files it is the next buffer full
+      of data; returns false if there is no more input */
+    bool read(const char *&begin, const char *&end);
+
+    /*! body of the read-ahead thread */
+    void readAhead();
+    /*! stop the read-ahead thread, if running */
+    void stopReading();
+    /*! the oldest buffer (by number) the lexer still holds on to */
+    size_t oldestHeld() const { return numHandedOut - std::min(numHandedOut,(size_t)2); }
+
     FileName name;
-    FILE *file;
+    /*! the stream a non-mapped file gets read from */
+    std::unique_ptr<InputStream> stream;
+    /*! the mapped file content (if mapped), and whether it has already
+      been handed to the lexer */
+    char  *mappedData;
+    size_t mappedSize;
+    bool   mappedDone;
+    /*! whether mappedData is our own mapping (rather than the data of
+      an in-memory file) */
+    bool   ownsMapping;
+
+    /*! ring of read-ahead buffers of a streamed file. the n'th buffer
+      read goes into buffers[n % buffers.size()]; the lexer holds on
+      to the last two it got (the current one, plus the previous one
+      for locs of tokens that started there), all others are the
+      reader thread's to fill */
+    struct Buffer {
+      char  *data;
+      size_t size;
+    };
+    std::vector<Buffer>     buffers;
+    size_t                  bufferSize;
+    std::thread             reader;
+    std::mutex              readerMutex;
+    std::condition_variable readerCond;
+    /*! number of buffers filled by the reader, and handed to the lexer */
+    size_t                  numFilled, numHandedOut;
+    /*! set once the reader hit the end of the stream, or got stopped */
+    bool                    readerDone, readerStop;
+    /*! what went wrong on the reader thread, if anything */
+    std::string             readerError;
+    double                  secondsBlocked;
+    size_t                  numBytesRead;
+
+    /*! newline index: number of newlines before the start of each
+      block. for streamed files a block is a read buffer (and gets
+      indexed as it gets read); for mapped files it has a fixed size
+      and the index gets built on demand */
+    struct Block {
+      size_t offset;
+      size_t linesBefore;
+    };
+    mutable std::vector<Block> blocks;
+    mutable std::mutex         blocksMutex;
   };
 
   /*! struct referring to a 'loc'ation in the input stream, given by
-    file name and line number */
+    file and byte offset. line and column only get computed when the
+    loc gets printed. note the loc does not own the file; it is only
+    valid for as long as the lexer reading that file is alive */
   struct PBRT_PARSER_INTERFACE Loc { 
+    //! default constructor, for a not-yet-known location
+    Loc() : file(nullptr), offset(0) {}
     //! constructor
-    Loc(std::shared_ptr<File> file);
-    //! copy-constructor
-    Loc(const Loc &loc);
+    Loc(const File *file, size_t offset) : file(file), offset(offset) {}
       
     //! pretty-print
     std::string toString() const;
 
-    friend class Lexer;
-  private:
-    std::shared_ptr<File> file;
-    int line, col;
+    const File *file;
+    size_t      offset;
   };
 
+  /*! a token, as produced by the lexer. tokens are small values that
+    refer to their text rather than owning it: for a mapped file the
+    text points right into the mapped file (and stays valid for as
+    long as the file lives); for streamed files it points into the
+    lexer's lookahead ring, and stays valid until the lexer produced
+    another Lexer::RING_SIZE-1 tokens. A default-constructed token
+    (of type TOKEN_TYPE_NONE) marks the end of the input. */
   struct PBRT_PARSER_INTERFACE Token {
 
-    typedef enum { TOKEN_TYPE_STRING, TOKEN_TYPE_LITERAL, TOKEN_TYPE_SPECIAL } Type;
+    typedef enum { TOKEN_TYPE_NONE=0, TOKEN_TYPE_STRING, TOKEN_TYPE_LITERAL, TOKEN_TYPE_SPECIAL } Type;
 
+    //! constructor for an 'end of input' token
+    Token() : type(TOKEN_TYPE_NONE), keyword(KEYWORD_NONE) {}
     //! constructor
     Token(const Loc &loc, 
           const Type type,
-          const std::string &text);
+          const TextView &text);
     //! pretty-print
     std::string toString() const;
-      
-    inline operator std::string() const { return text// toString()
-        ; }
-    inline const char *c_str() const { return text.c_str(); }
 
-    const Loc         loc;
-    const std::string text;
-    const Type        type;
+    /*! returns true for any token other than the end of input */
+    inline explicit operator bool() const { return type != TOKEN_TYPE_NONE; }
+
+    Type     type;
+    /*! which keyword this token's text is, if any */
+    Keyword  keyword;
+    /*! the token's chars, without any quotes around string tokens */
+    TextView text;
+    /*! where the token (including any quotes) starts */
+    Loc      loc;
   };
 
 
@@ -80,30 +209,181 @@ namespace pbrt_parser {
     stream of chars into an input stream of tokens.  */
   struct PBRT_PARSER_INTERFACE Lexer {
 
-    //! constructor
-    Lexer(const FileName &fn);
+    /*! number of tokens the lexer keeps around: the maximum peek()
+      depth, and how many tokens a token's (streamed) text survives */
+    enum { RING_SIZE = 8 };
+
+    /*! constructor. with config.numThreads > 1 (or 0, for 'all
+      cores') a mapped file gets lexed in parallel: the file gets
+      split into chunks that get tokenized on worker threads (in
+      batches, ahead of the parser), and the parser then consumes the
+      merged token streams in order */
+    Lexer(const FileName &fn, const LexerConfig &config=LexerConfig());
+    /*! lexer for in-memory data (see the corresponding File constructor) */
+    Lexer(const std::string &name, const char *data, size_t size,
+          const LexerConfig &config=LexerConfig());
+    /*! lexer for data read from a stream */
+    Lexer(const std::string &name, std::istream &in,
+          const LexerConfig &config=LexerConfig());
+    /*! lexer for an already opened file */
+    Lexer(const std::shared_ptr<File> &file, const LexerConfig &config=LexerConfig());
+    ~Lexer();
+
+    /*! the file we're reading from */
+    const File &getFile() const { return *file; }
+    /*! the file we're reading from, for holding on to its (mapped)
+      chars beyond the lexer's lifetime */
+    std::shared_ptr<const File> shareFile() const { return file; }
 
-    std::shared_ptr<Token> next();
-    std::shared_ptr<Token> peek(size_t i=0);
+    Token next();
+    Token peek(size_t i=0);
+
+    /*! fused decoding of a bracketed list of numbers: assuming the
+      opening '[' has just been consumed, decode the numbers that
+      follow straight into 'values', without producing any tokens
+      for them. returns true once the closing ']' got consumed; if
+      something other than a number shows up it stops right before
+      that, and returns false - the caller then has to continue with
+      regular tokens. */
+    bool readNumbers(AlignedVector<float> &values);
+    bool readNumbers(AlignedVector<int>   &values);
+    /*! like readNumbers(), but without decoding anything: if the
+      bracketed list that follows consists of nothing but white space
+      separated literals, consume it (including the closing ']'), and
+      return the text between the brackets - which points into the
+      file's (mapped) chars, so stays valid for as long as the File
+      lives. if that is not the case, or the list is shorter than
+      'minSize' chars, or the file isn't mapped, or we lex in
+      parallel, returns false without consuming anything */
+    bool skipNumbers(TextView &text, size_t minSize=0);
+    /*! skip the rest of the current statement - strings, bracketed
+      lists (with whatever is in them), comments, and any literals
+      that aren't keywords - up to right before the next statement's
+      keyword (or the end of the input). unless we lex in parallel,
+      this works directly on the input chars: no tokens get produced,
+      and no numbers decoded */
+    void skipStatement();
       
   private:
-    Loc getLastLoc() { return loc; }
+    template<typename T>
+    inline bool readNumbersT(AlignedVector<T> &values);
+    /*! skipStatement()'s scan over the input chars: stops right before
+      the next literal outside of brackets, or at the end of the
+      input */
+    inline void skipChars();
+
+    /*! fetch the next window of input chars from the file, retaining
+      the already-read part of a token that spans two windows */
+    inline bool refill();
+
+    /*! produce the next token from the input stream into the given
+      ring slot; produces an end-of-input token if end of (all files)
+      is reached */
+    inline void produceNextToken(Token &token);
+
+    /*! finish the token whose chars are [tokenBegin,tokenEnd) (plus
+      whatever got already saved in this slot from previous
+      windows) */
+    inline void makeToken(Token &token,
+                          const Token::Type type,
+                          const char *tokenEnd);
+
+    /*! a token of a mapped file, as stored in a chunk: less than
+      half the size of a Token, as most of the cost of lexing in
+      parallel is in moving the tokens from the workers to the
+      parser. its text is the 'size' chars starting at 'offset' (or,
+      for strings, right after the opening quote there) */
+    struct ChunkToken {
+      ChunkToken(const Token &token)
+        : offset(token.loc.offset), size((uint32_t)token.text.size),
+          keyword((uint16_t)token.keyword), type((uint16_t)token.type)
+      {}
 
-    inline void unget_char(int c);
-    inline int get_char();
-    inline bool isWhite(const char c);
-    inline bool isSpecial(const char c);
+      uint64_t offset;
+      uint32_t size;
+      uint16_t keyword;
+      uint16_t type;
+    };
+    /*! one chunk of a mapped file, as tokenized by a worker thread */
+    struct Chunk {
+      /*! the chunk's tokens; the ones before 'first' turned out to be
+        wrong (or belong to the previous chunk) */
+      std::vector<ChunkToken> tokens;
+      size_t             first;
+      /*! offset of the first token at or after the end of the chunk
+        (or the file size, if there is none) */
+      size_t             next;
+      /*! false if lexing stopped at a string that does not end */
+      bool               complete;
+    };
+    /*! a batch of chunks: one per worker thread */
+    struct Batch {
+      std::vector<Chunk>  chunks;
+      /*! chunk i covers tokens starting in [bounds[i],bounds[i+1]) */
+      std::vector<size_t> bounds;
+      /*! next token to hand out */
+      size_t              chunkID, tokenID;
+    };
 
-    /*! produce the next token from the input stream; return NULL if
-      end of (all files) is reached */
-    inline std::shared_ptr<Token> produceNextToken();
+    /*! what lexMappedToken() found */
+    enum MappedToken { MAPPED_TOKEN, MAPPED_END, MAPPED_OPEN_STRING };
+    /*! lex the token at (or, past white space and comments, after)
+      'pos' in the mapped file, and advance 'pos' past it. for a
+      string that does not end, only the token's loc gets set */
+    inline MappedToken lexMappedToken(const char *&pos, Token &token) const;
+    /*! tokenize the tokens starting in [begin,stop) of the mapped
+      file. if 'resync' is set, 'begin' is not known to be a token
+      boundary, and lexing starts at the next line (or the next
+      delimiter) instead - the tokens found that way are speculative,
+      and get checked when merging. never throws; lexing errors get found (and reported)
+      in the merge */
+    void lexChunk(Chunk &chunk, size_t begin, size_t stop, bool resync) const;
+    /*! bring a speculatively lexed chunk in sync with the sequential
+      lexer that is at 'next': lex from there, appending to 'before'
+      (the tokens that precede the chunk's), until getting to the
+      start of one of the chunk's tokens - or to 'stop' */
+    void resyncChunk(Chunk &chunk, std::vector<ChunkToken> &before, size_t next, size_t stop) const;
+    /*! start lexing the batch of chunks that starts at given offset */
+    void startBatch(Batch &batch, size_t begin);
+    /*! wait for the workers to finish the batch, then validate and
+      merge its chunks; returns the offset of the first token after
+      the batch */
+    size_t finishBatch(Batch &batch);
+    /*! produce the next token from the parallel-lexed batches */
+    inline void produceNextBatchToken(Token &token);
+    /*! body of worker thread 'workerID', which lexes that chunk of
+      each batch */
+    void lexAhead(size_t workerID);
 
+    int   numThreads;
+    /*! the batch the parser is consuming, and the one being lexed */
+    Batch current, pending;
+    /*! the worker threads, which live as long as the lexer */
+    std::vector<std::thread> workers;
+    std::mutex               workerMutex;
+    std::condition_variable  workerCond, batchDoneCond;
+    /*! number of batches handed to the workers so far, and number of
+      workers still busy with the last one */
+    size_t                   numBatchesStarted, numWorkersBusy;
+    bool                     workersStop;
 
+    /*! lookahead ring: tokens [numConsumed,numProduced) (modulo
+      RING_SIZE) have been peeked, but not yet been consumed */
+    Token       ring[RING_SIZE];
+    /*! per-slot storage of the text of streamed tokens */
+    std::string ringText[RING_SIZE];
+    size_t      numProduced, numConsumed;
 
-    std::deque<std::shared_ptr<Token> > peekedTokens;
     std::shared_ptr<File> file;
-    Loc loc;
-    int peekedChar;
+    /*! current window of input chars, and read position therein */
+    const char *pos, *end;
+    /*! first char of the current window, and its offset in the file */
+    const char *windowBegin;
+    size_t      windowOffset;
+    /*! first char of the token currently being lexed, if any, and
+      the slot it is being lexed into */
+    const char *tokenBegin;
+    size_t      tokenSlot;
   };
 
 } // ::pbrt_parser
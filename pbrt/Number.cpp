@@ -0,0 +1,86 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "Number.h"
+// std
+#include <sstream>
+#include <locale>
+#include <limits>
+#include <cctype>
+
+namespace pbrt_parser {
+
+  /*! case-insensitively check whether [s,end) starts with 'word' */
+  static bool startsWith(const char *s, const char *end, const char *word)
+  {
+    for (;*word;++s,++word)
+      if (s == end || tolower(*s) != *word) return false;
+    return true;
+  }
+
+  const char *scanFloatSlow(const char *begin, const char *end, double &result)
+  {
+    const char *s = begin;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = (*s++ == '-');
+
+    if (startsWith(s,end,"inf")) {
+      result = negative
+        ? -std::numeric_limits<double>::infinity()
+        : +std::numeric_limits<double>::infinity();
+      return s+(startsWith(s,end,"infinity") ? 8 : 3);
+    }
+    if (startsWith(s,end,"nan")) {
+      result = std::numeric_limits<double>::quiet_NaN();
+      return s+3;
+    }
+
+    /* find the extent of the number ... */
+    const char *e = s;
+    bool anyDigits = false;
+    for (;e < end && unsigned(*e-'0') < 10; ++e) anyDigits = true;
+    if (e < end && *e == '.')
+      for (++e;e < end && unsigned(*e-'0') < 10; ++e) anyDigits = true;
+    if (!anyDigits) {
+      result = 0.;
+      return begin;
+    }
+    if (e < end && (*e == 'e' || *e == 'E')) {
+      const char *x = e+1;
+      if (x < end && (*x == '-' || *x == '+')) ++x;
+      if (x < end && unsigned(*x-'0') < 10) {
+        while (x < end && unsigned(*x-'0') < 10) ++x;
+        e = x;
+      }
+    }
+
+    /* ... and have a classic-locale stream do the conversion */
+    std::istringstream in(std::string(s,e));
+    in.imbue(std::locale::classic());
+    double d = 0.;
+    in >> d;
+    if (in.fail()) {
+      /* out of range: underflow if the exponent is negative, else
+         overflow */
+      const char *x = s;
+      while (x < e && *x != 'e' && *x != 'E') ++x;
+      d = (x+1 < e && x[1] == '-') ? 0. : std::numeric_limits<double>::infinity();
+    }
+    result = negative ? -d : d;
+    return e;
+  }
+
+} // ::pbrt_parser
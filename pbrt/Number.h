@@ -0,0 +1,132 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+/*! \file Number.h fast, locale-independent number parsing on char
+    ranges. These follow atof/atoi semantics - they parse the longest
+    prefix of the range that forms a number, and return 0 if there is
+    none - but do not need a '\0'-terminated string, and do not depend
+    on the current locale. */
+
+#include "pbrt/pbrt.h"
+// std
+#include <stdint.h>
+
+namespace pbrt_parser {
+
+  /*! slow path for scanFloat: decimals with more than 19 significant
+    digits or large exponents, as well as 'inf' and 'nan' */
+  PBRT_PARSER_INTERFACE const char *scanFloatSlow(const char *begin, const char *end, double &result);
+
+  /*! parse a float from the chars in [begin,end), and return a pointer
+    to the first char after it */
+  inline const char *scanFloat(const char *begin, const char *end, float &result)
+  {
+    static const double exact[23] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char *s = begin;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = (*s++ == '-');
+
+    uint64_t mantissa  = 0;
+    int      numDigits = 0;
+    int      exponent  = 0;
+    bool     anyDigits = false;
+    for (;s < end && unsigned(*s-'0') < 10; ++s) {
+      anyDigits = true;
+      if (mantissa == 0 && *s == '0') continue;
+      if (numDigits++ < 19) mantissa = 10*mantissa+(*s-'0'); else ++exponent;
+    }
+    if (s < end && *s == '.') {
+      ++s;
+      for (;s < end && unsigned(*s-'0') < 10; ++s) {
+        anyDigits = true;
+        if (mantissa == 0 && *s == '0') { --exponent; continue; }
+        if (numDigits++ < 19) { mantissa = 10*mantissa+(*s-'0'); --exponent; }
+      }
+    }
+    if (!anyDigits) {
+      double d;
+      const char *e = scanFloatSlow(begin,end,d);
+      result = (float)d;
+      return e;
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+      const char *e = s+1;
+      bool negativeExp = false;
+      if (e < end && (*e == '-' || *e == '+')) negativeExp = (*e++ == '-');
+      if (e < end && unsigned(*e-'0') < 10) {
+        int exp = 0;
+        for (;e < end && unsigned(*e-'0') < 10; ++e)
+          if (exp < 100000) exp = 10*exp+(*e-'0');
+        exponent += negativeExp ? -exp : exp;
+        s = e;
+      }
+    }
+
+    if (mantissa == 0) {
+      result = negative ? -0.f : 0.f;
+      return s;
+    }
+    if (numDigits > 19 || mantissa > (uint64_t(1)<<53) || exponent < -22 || exponent > 22) {
+      double d;
+      const char *e = scanFloatSlow(begin,end,d);
+      result = (float)d;
+      return e;
+    }
+    /* both mantissa and power of ten are exact doubles, so this is
+       correctly rounded - exactly what strtod would have given */
+    double d = (double)mantissa;
+    d = (exponent < 0) ? d / exact[-exponent] : d * exact[exponent];
+    result = (float)(negative ? -d : d);
+    return s;
+  }
+
+  /*! parse an int from the chars in [begin,end), and return a pointer
+    to the first char after it */
+  inline const char *scanInt(const char *begin, const char *end, int &result)
+  {
+    const char *s = begin;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = (*s++ == '-');
+    const char *digits = s;
+    int64_t value = 0;
+    for (;s < end && unsigned(*s-'0') < 10; ++s)
+      value = 10*value+(*s-'0');
+    result = int(negative ? -value : value);
+    return (s == digits) ? begin : s;
+  }
+
+  /*! parse a float from given text, the way atof would */
+  inline float toFloat(const TextView &text)
+  {
+    float f;
+    scanFloat(text.begin,text.end(),f);
+    return f;
+  }
+
+  /*! parse an int from given text, the way atoi would */
+  inline int toInt(const TextView &text)
+  {
+    int i;
+    scanInt(text.begin,text.end(),i);
+    return i;
+  }
+  
+} // ::pbrt_parser
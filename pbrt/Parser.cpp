@@ -16,10 +16,16 @@
 
 #include "Parser.h"
 #include "Lexer.h"
+#include "Number.h"
+#include "CharClass.h"
 // stl
 #include <fstream>
 #include <sstream>
+#include <iostream>
 #include <stack>
+#include <atomic>
+#include <thread>
+#include <exception>
 // std
 #include <stdio.h>
 #include <string.h>
@@ -27,14 +33,12 @@
 namespace pbrt_parser {
     using namespace std;
 
-    int verbose = 0;
-
     inline float parseFloat(Lexer &tokens)
     {
-      std::shared_ptr<Token> token = tokens.next();
+      const Token token = tokens.next();
       if (!token)
         throw std::runtime_error("unexpected end of file\n@"+std::string(__PRETTY_FUNCTION__));
-      return atof(token->text.c_str());
+      return toFloat(token.text);
     }
 
     inline vec3f parseVec3f(Lexer &tokens)
@@ -49,118 +53,401 @@ namespace pbrt_parser {
       }
     }
 
-  inline std::shared_ptr<Param> Parser::parseParam(std::string &name, Lexer &tokens)
+  template<typename T>
+  std::shared_ptr<Param> createParam(ParamType type)
+  { return std::make_shared<ParamT<T>>(type); }
+
+  /*! clear a parameter's values, for reusing it */
+  template<typename T>
+  void clearParam(Param *param)
+  {
+    ((ParamT<T> *)param)->paramVec.clear();
+    ((ParamT<T> *)param)->lazy.reset();
+  }
+  template<>
+  void clearParam<Texture>(Param *param)
+  { ((ParamT<Texture> *)param)->texture.reset(); }
+
+  /*! set a vector parameter's values from the given floats (whose
+    number has already been checked) */
+  template<typename V>
+  void setComponents(Param *param, const AlignedVector<float> &components)
+  {
+    AlignedVector<V> &values = ((ParamT<V> *)param)->paramVec;
+    values.resize(components.size()/(sizeof(V)/sizeof(float)));
+    memcpy((void *)values.data(),components.data(),values.size()*sizeof(V));
+  }
+
+  /*! how to parse a parameter type */
+  struct ParamTypeInfo {
+    const char *name;
+    size_t      size;
+    std::shared_ptr<Param> (*create)(ParamType type);
+    void (*clear)(Param *param);
+    /*! for vector types: how many floats make up one value, and how
+      to set the parameter from them; 1 and null for all others */
+    size_t numComponents;
+    void (*setComponents)(Param *param, const AlignedVector<float> &components);
+  };
+
+  /*! all parameter types, in the order of (and indexed by) the
+    ParamType enum, which has the most frequently used ones first */
+  static const ParamTypeInfo paramTypes[NUM_PARAM_TYPES] = {
+    { "float",    5, createParam<float>,       clearParam<float>,       1, nullptr },
+    { "rgb",      3, createParam<vec3f>,       clearParam<vec3f>,       3, setComponents<vec3f> },
+    { "texture",  7, createParam<Texture>,     clearParam<Texture>,     1, nullptr },
+    { "string",   6, createParam<std::string>, clearParam<std::string>, 1, nullptr },
+    { "integer",  7, createParam<int>,         clearParam<int>,         1, nullptr },
+    { "point",    5, createParam<vec3f>,       clearParam<vec3f>,       3, setComponents<vec3f> },
+    { "color",    5, createParam<vec3f>,       clearParam<vec3f>,       3, setComponents<vec3f> },
+    { "bool",     4, createParam<bool>,        clearParam<bool>,        1, nullptr },
+    { "normal",   6, createParam<vec3f>,       clearParam<vec3f>,       3, setComponents<vec3f> },
+    { "spectrum", 8, createParam<std::string>, clearParam<std::string>, 1, nullptr },
+    { "point2",   6, createParam<vec2f>,       clearParam<vec2f>,       2, setComponents<vec2f> },
+    { "point3",   6, createParam<vec3f>,       clearParam<vec3f>,       3, setComponents<vec3f> },
+    { "point4",   6, createParam<float>,       clearParam<float>,       1, nullptr },
+    { "vector",   6, createParam<vec3f>,       clearParam<vec3f>,       3, setComponents<vec3f> },
+  };
+  static const ParamTypeInfo *const textureParamType = &paramTypes[PARAM_TYPE_TEXTURE];
+
+  /*! with Parser::lazyArrays, numeric arrays of at least that many
+    chars get decoded lazily; smaller ones aren't worth it, and get
+    decoded right away */
+  static const size_t LAZY_ARRAY_MIN_SIZE = 1<<12;
+
+  /*! the shape types that become TriangleMeshes */
+  static const Symbol triangleMeshType("trianglemesh");
+  static const Symbol plyMeshType("plymesh");
+  /*! type of named materials until we've parsed their 'type' */
+  static const Symbol implicitMaterialType("<implicit>");
+
+  inline const ParamTypeInfo *findParamType(const TextView &type)
+  {
+    for (const ParamTypeInfo &t : paramTypes)
+      if (t.size == type.size && memcmp(t.name,type.begin,type.size) == 0)
+        return &t;
+    return nullptr;
+  }
+
+  /*! split a parameter declaration of the form "<type> <name>" (with
+    arbitrary white space around and between the two) in place;
+    returns false if it isn't one */
+  inline bool splitParamDecl(const TextView &decl, TextView &type, TextView &name)
+  {
+    const char *end = decl.end();
+    const char *s = skipWhite(decl.begin,end);
+    const char *e = s;
+    while (e < end && !isWhite(*e)) ++e;
+    type = TextView(s,e);
+    s = skipWhite(e,end);
+    e = s;
+    while (e < end && !isWhite(*e)) ++e;
+    name = TextView(s,e);
+    return type.size > 0 && name.size > 0;
+  }
+
+  Symbol Parser::intern(const TextView &text)
+  {
+    auto it = symbols.find(text);
+    if (it != symbols.end())
+      return it->second;
+    const Symbol symbol(text);
+    symbols.emplace(TextView(symbol.str()),symbol);
+    return symbol;
+  }
+
+  void Parser::recycleParams(Parameterized &node)
+  {
+    if (recycledParams.empty())
+      recycledParams.resize(NUM_PARAM_TYPES);
+    for (const ParamList::Entry &entry : node.param) {
+      /* still in use by someone else */
+      if (entry.param.use_count() > 1) continue;
+      paramTypes[entry.param->type].clear(entry.param.get());
+      recycledParams[entry.param->type].push_back(entry.param);
+    }
+    node.param.clear();
+  }
+
+  template<typename T>
+  inline bool Parser::skipArray(ParamT<T> &param, Lexer &tokens)
+  {
+    TextView text;
+    if (!tokens.skipNumbers(text,LAZY_ARRAY_MIN_SIZE))
+      return false;
+    param.lazy = std::make_shared<LazyValues>(text,tokens.shareFile(),lazyArrayThreads);
+    return true;
+  }
+
+  /*! whether the given parameter's values got skipped, to only get
+    decoded when needed */
+  inline bool isLazy(const Param &param)
+  {
+    switch (param.storage) {
+    case PARAM_STORAGE_FLOAT: return (bool)param.as<float>()->lazy;
+    case PARAM_STORAGE_VEC3F: return (bool)param.as<vec3f>()->lazy;
+    case PARAM_STORAGE_VEC2F: return (bool)param.as<vec2f>()->lazy;
+    case PARAM_STORAGE_INT:   return (bool)param.as<int>()->lazy;
+    default:                  return false;
+    }
+  }
+
+  /*! the parameters of a 'trianglemesh' that become its arrays */
+  static const char *const triangleMeshArrays[] = { "P", "N", "uv", "st", "indices" };
+
+  /*! make sure a mesh's normals and texcoords (if any) match its
+    vertices, and its indices all refer to one of them */
+  static void checkTriangleMesh(const TriangleMesh &mesh)
+  {
+    const size_t numVertices = mesh.vertex.size();
+    if (!mesh.normal.empty() && mesh.normal.size() != numVertices)
+      throw std::runtime_error(mesh.type+" has "+std::to_string(mesh.normal.size())
+                               +" normals for "+std::to_string(numVertices)+" vertices");
+    if (!mesh.texcoord.empty() && mesh.texcoord.size() != numVertices)
+      throw std::runtime_error(mesh.type+" has "+std::to_string(mesh.texcoord.size())
+                               +" texture coordinates for "+std::to_string(numVertices)+" vertices");
+    for (const vec3i &idx : mesh.index)
+      if ((size_t)idx.x >= numVertices ||
+          (size_t)idx.y >= numVertices ||
+          (size_t)idx.z >= numVertices)
+        throw std::runtime_error(mesh.type+" has a triangle with invalid vertex index "
+                                 "(only "+std::to_string(numVertices)+" vertices)");
+  }
+
+  /*! get the values of the named array parameter (already viewed
+    as 'values') into 'array': by taking over the parameter's storage
+    if it's of the right type and nobody else holds on to it, else by
+    copying */
+  template<typename V>
+  static void takeArray(const Parameterized &geometry, const char *name,
+                        const ArrayView<V> &values, AlignedVector<V> &array)
+  {
+    const ParamList::Entry *entry = geometry.param.find(name);
+    ParamT<V> *param = entry ? entry->param->as<V>() : nullptr;
+    if (param && entry->param.use_count() == 1)
+      array.swap(param->paramVec);
+    else
+      array.assign(values.begin(),values.end());
+  }
+
+  /*! fill in a 'trianglemesh's arrays from its P, N, uv/st and
+    indices parameters, taking over the storage of those that are
+    stored as vectors */
+  static void buildTriangleMesh(TriangleMesh &mesh, const Parameterized &geometry)
+  {
+    const ArrayView<vec3f> P = geometry.getArray3f("P");
+    if (P.empty())
+      throw std::runtime_error("trianglemesh without any vertices ('P')");
+    takeArray(geometry,"P",P,mesh.vertex);
+
+    const ArrayView<vec3i> indices = geometry.getArray3i("indices");
+    if (!indices.empty())
+      mesh.index.assign(indices.begin(),indices.end());
+    else if (mesh.vertex.size() == 3)
+      /* pbrt allows leaving out the indices of a single triangle */
+      mesh.index.push_back(vec3i(0,1,2));
+    else
+      throw std::runtime_error("trianglemesh without 'indices'");
+
+    takeArray(geometry,"N",geometry.getArray3f("N"),mesh.normal);
+
+    const char *uvName = "uv";
+    ArrayView<vec2f> uv = geometry.getArray2f(uvName);
+    if (uv.empty())
+      uv = geometry.getArray2f(uvName = "st");
+    takeArray(geometry,uvName,uv,mesh.texcoord);
+
+    checkTriangleMesh(mesh);
+  }
+
+  /*! fill in a 'plymesh's arrays from given ply file */
+  static void loadPlyMesh(TriangleMesh &mesh, const std::string &fileName)
+  {
+    parsePLY(fileName,mesh.vertex,mesh.normal,mesh.index);
+    checkTriangleMesh(mesh);
+  }
+
+  inline std::shared_ptr<Param> Parser::parseParam(Symbol &name, Lexer &tokens)
     {
-      std::shared_ptr<Token> token = tokens.peek();
-      if (!token || token->type != Token::TOKEN_TYPE_STRING)
+      Token token = tokens.peek();
+      if (!token || token.type != Token::TOKEN_TYPE_STRING)
         return std::shared_ptr<Param>();
 
       token = tokens.next();
-      char *_type = strdup(token->text.c_str());
-      char *_name = strdup(token->text.c_str());
-      int rc = sscanf(token->text.c_str(),"%s %s",_type,_name);
-      if (rc != 2)
+      TextView typeText, nameText;
+      if (!splitParamDecl(token.text,typeText,nameText))
         throw std::runtime_error("could not parse object parameter's type and name "
-                                 +token->loc.toString()
+                                 +token.loc.toString()
                                  +std::string("\n@")+std::string(__PRETTY_FUNCTION__));
-      string type = _type;
-      name = _name;
-      free(_name);
-      free(_type);
-
-      std::shared_ptr<Param> ret; 
-      if (type == "float") {
-        ret = std::make_shared<ParamT<float>>(type);
-      } else if (type == "color") {
-        ret = std::make_shared<ParamT<float> >(type);
-      } else if (type == "rgb") {
-        ret = std::make_shared<ParamT<float> >(type);
-      } else if (type == "spectrum") {
-        ret = std::make_shared<ParamT<std::string>>(type);
-      } else if (type == "integer") {
-        ret = std::make_shared<ParamT<int>>(type);
-      } else if (type == "bool") {
-        ret = std::make_shared<ParamT<bool>>(type);
-      } else if (type == "texture") {
-        ret = std::make_shared<ParamT<Texture>>(type);
-      } else if (type == "normal") {
-        ret = std::make_shared<ParamT<float> >(type);
-      } else if (type == "point") {
-        ret = std::make_shared<ParamT<float>>(type);
-      } else if (type == "point2") {
-        ret = std::make_shared<ParamT<float>>(type);
-      } else if (type == "point3") {
-        ret = std::make_shared<ParamT<float>>(type);
-      } else if (type == "point4") {
-        ret = std::make_shared<ParamT<float>>(type);
-      } else if (type == "vector") {
-        ret = std::make_shared<ParamT<float>>(type);
-      } else if (type == "string") {
-        ret = std::make_shared<ParamT<std::string>>(type);
-      } else {
-        throw std::runtime_error("unknown parameter type '"+type+"' "+token->loc.toString()
+      const ParamTypeInfo *type = findParamType(typeText);
+      if (!type)
+        throw std::runtime_error("unknown parameter type '"+typeText.str()+"' "+token.loc.toString()
                                  +std::string("\n@")+std::string(__PRETTY_FUNCTION__));
-      }
+      name = intern(nameText);
 
-      std::shared_ptr<Token> value = tokens.next();
-      if (value->text == "[") {
-        std::shared_ptr<Token> p = tokens.next();
+      std::shared_ptr<Param> ret;
+      if (!recycledParams.empty() && !recycledParams[type-paramTypes].empty()) {
+        ret = std::move(recycledParams[type-paramTypes].back());
+        recycledParams[type-paramTypes].pop_back();
+      } else
+        ret = type->create((ParamType)(type-paramTypes));
+      const bool isTexture = (type == textureParamType);
+      /* vector values get read as floats first */
+      const bool isVector  = (type->setComponents != nullptr);
+      components.clear();
+
+      Token value = tokens.next();
+      if (value.text == "[") {
+        /* lists of numbers get decoded by the lexer directly (or,
+           if large, and we're asked to, only when needed) */
+        bool done = false;
+        switch (ret->storage) {
+        case PARAM_STORAGE_FLOAT:
+          done = (lazyArrays && skipArray(*ret->as<float>(),tokens)) || tokens.readNumbers(ret->as<float>()->paramVec);
+          break;
+        case PARAM_STORAGE_VEC3F:
+          if (lazyArrays && skipArray(*ret->as<vec3f>(),tokens))
+            return ret;
+          done = tokens.readNumbers(components);
+          break;
+        case PARAM_STORAGE_VEC2F:
+          if (lazyArrays && skipArray(*ret->as<vec2f>(),tokens))
+            return ret;
+          done = tokens.readNumbers(components);
+          break;
+        case PARAM_STORAGE_INT:
+          done = (lazyArrays && skipArray(*ret->as<int>(),tokens)) || tokens.readNumbers(ret->as<int>()->paramVec);
+          break;
+        default:
+          break;
+        }
+        if (done && !isVector)
+          return ret;
         
-        while (p->text != "]") {
-          if (type == "texture") {
-            std::dynamic_pointer_cast<ParamT<Texture>>(ret)->texture 
-              = getTexture(p->text);
-          } else {
-            ret->add(p->text);
+        if (!done) {
+          Token p = tokens.next();
+        
+          while (p.text != "]") {
+            if (!p)
+              throw std::runtime_error("unexpected end of file in parameter list "
+                                       +token.loc.toString());
+            if (isTexture) {
+              std::static_pointer_cast<ParamT<Texture>>(ret)->texture 
+                = getTexture(p.text);
+            } else if (isVector) {
+              components.push_back(toFloat(p.text));
+            } else {
+              ret->add(p.text);
+            }
+            p = tokens.next();
           }
-          p = tokens.next();
         }
       } else {
-        if (type == "texture") {
-          std::dynamic_pointer_cast<ParamT<Texture>>(ret)->texture 
-            = getTexture(value->text);
+        if (isTexture) {
+          std::static_pointer_cast<ParamT<Texture>>(ret)->texture 
+            = getTexture(value.text);
+        } else if (isVector) {
+          components.push_back(toFloat(value.text));
         } else {
-          ret->add(value->text);
+          ret->add(value.text);
         }
       }
+      if (isVector) {
+        if (components.size() % type->numComponents)
+          throw std::runtime_error("number of values of "+typeText.str()+" parameter '"+name+"' "
+                                   "isn't a multiple of "+std::to_string(type->numComponents)+" "
+                                   +token.loc.toString());
+        type->setComponents(ret.get(),components);
+      }
       return ret;
     }
 
-  void Parser::parseParams(std::map<std::string, std::shared_ptr<Param> > &params, Lexer &tokens)
+  void Parser::parseParams(ParamList &params, Lexer &tokens)
     {
       while (1) {
-        std::string name;
+        Symbol name;
         std::shared_ptr<Param> param = parseParam(name,tokens);
         if (!param) return;
-        params[name] = param;
+        params.set(name,param);
       }
     }
 
-    Attributes::Attributes()
-    {
-    }
-
-  // Attributes::Attributes(const Attributes &other)
-  //   {
-  //   }
-
-
   std::shared_ptr<Texture> Parser::getTexture(const std::string &name) 
   {
-    // PING; PRINT(attributesStack.top()->namedTexture.size());
-    if (attributesStack.top()->namedTexture.find(name) == attributesStack.top()->namedTexture.end())
+    std::shared_ptr<Texture> texture = attributesStack.top()->findNamedTexture(name);
+    if (!texture && skippedTextures.count(name))
+      return texture;
+    if (!texture)
       throw std::runtime_error("no texture named '"+name+"'");
-    return attributesStack.top()->namedTexture[name]; 
+    return texture;
+  }
+
+  Attributes &Parser::modifyAttributes()
+  {
+    std::shared_ptr<Attributes> &attributes = attributesStack.top();
+    /* shared with an outer attribute scope, or some shape: leave
+       those alone, and add our changes in a new layer */
+    if (attributes.use_count() > 1)
+      attributes = Attributes::derive(attributes);
+    return *attributes;
   }
 
     Parser::Parser(bool dbg, const std::string &basePath) 
-      : scene(std::make_shared<Scene>()), dbg(dbg), basePath(basePath) 
+      : sink(nullptr), logSink([](const std::string &message) { std::cout << message << std::endl; }),
+        lazyArrays(false), lazyArrayThreads(1),
+        secondsBlockedOnInput(0), inSkippedObject(false), scene(std::make_shared<Scene>()), dbg(dbg), basePath(basePath) 
     {
       transformStack.push(affine3f(ospcommon::one));
       attributesStack.push(std::make_shared<Attributes>());
       objectStack.push(scene->world);//scene.cast<Object>());
     }
 
+    inline bool Parser::skipStatement(Keyword statement, const std::string &argument)
+    {
+      if (!inSkippedObject && (!filter || filter(statement,argument)))
+        return false;
+      tokens->skipStatement();
+      return true;
+    }
+
+    void Parser::setupTriangleMesh(TriangleMesh &mesh)
+    {
+      std::function<void(TriangleMesh &)> load;
+      if (mesh.type == plyMeshType) {
+        FileName fileName = mesh.getParamString("filename");
+        if (fileName.str() == "")
+          throw std::runtime_error("plymesh without a 'filename'");
+        if (fileName.str()[0] != '/')
+          fileName = rootNamePath+fileName;
+        if (!lazyArrays) {
+          loadPlyMesh(mesh,fileName.str());
+          return;
+        }
+        load = [fileName](TriangleMesh &mesh) { loadPlyMesh(mesh,fileName.str()); };
+      } else {
+        /* move the geometry out of the mesh's parameters, so they
+           don't stay around twice */
+        Parameterized geometry;
+        bool anyLazy = false;
+        for (const char *name : triangleMeshArrays) {
+          const ParamList::Entry *entry = mesh.param.find(name);
+          if (!entry) continue;
+          anyLazy |= isLazy(*entry->param);
+          geometry.param.set(entry->name,entry->param);
+          mesh.param.erase(name);
+        }
+        /* nothing to be saved by deferring arrays we have already
+           decoded */
+        if (!anyLazy) {
+          buildTriangleMesh(mesh,geometry);
+          return;
+        }
+        load = [geometry](TriangleMesh &mesh) { buildTriangleMesh(mesh,geometry); };
+      }
+      mesh.loader = std::make_shared<TriangleMesh::Loader>();
+      mesh.loader->load = std::move(load);
+    }
+
     std::shared_ptr<Object> Parser::getCurrentObject() 
     {
       if (objectStack.empty())
@@ -185,7 +472,7 @@ namespace pbrt_parser {
 
     void Parser::pushAttributes() 
     {
-      attributesStack.push(std::make_shared<Attributes>(*attributesStack.top()));
+      attributesStack.push(attributesStack.top());
       materialStack.push(currentMaterial);
       pushTransform();
       // setTransform(ospcommon::one);
@@ -212,71 +499,72 @@ namespace pbrt_parser {
     
     affine3f parseMatrix(Lexer &tokens)
     {
-      const std::string open = *tokens.next();
+      const std::string open = tokens.next().text;
 
       assert(open == "[");
       affine3f xfm;
-      xfm.l.vx.x = atof(tokens.next()->c_str());
-      xfm.l.vx.y = atof(tokens.next()->c_str());
-      xfm.l.vx.z = atof(tokens.next()->c_str());
-      float vx_w = atof(tokens.next()->c_str());
+      xfm.l.vx.x = toFloat(tokens.next().text);
+      xfm.l.vx.y = toFloat(tokens.next().text);
+      xfm.l.vx.z = toFloat(tokens.next().text);
+      float vx_w = toFloat(tokens.next().text);
       assert(vx_w == 0.f);
 
-      xfm.l.vy.x = atof(tokens.next()->c_str());
-      xfm.l.vy.y = atof(tokens.next()->c_str());
-      xfm.l.vy.z = atof(tokens.next()->c_str());
-      float vy_w = atof(tokens.next()->c_str());
+      xfm.l.vy.x = toFloat(tokens.next().text);
+      xfm.l.vy.y = toFloat(tokens.next().text);
+      xfm.l.vy.z = toFloat(tokens.next().text);
+      float vy_w = toFloat(tokens.next().text);
       assert(vy_w == 0.f);
 
-      xfm.l.vz.x = atof(tokens.next()->c_str());
-      xfm.l.vz.y = atof(tokens.next()->c_str());
-      xfm.l.vz.z = atof(tokens.next()->c_str());
-      float vz_w = atof(tokens.next()->c_str());
+      xfm.l.vz.x = toFloat(tokens.next().text);
+      xfm.l.vz.y = toFloat(tokens.next().text);
+      xfm.l.vz.z = toFloat(tokens.next().text);
+      float vz_w = toFloat(tokens.next().text);
       assert(vz_w == 0.f);
 
-      xfm.p.x    = atof(tokens.next()->c_str());
-      xfm.p.y    = atof(tokens.next()->c_str());
-      xfm.p.z    = atof(tokens.next()->c_str());
-      float p_w  = atof(tokens.next()->c_str());
+      xfm.p.x    = toFloat(tokens.next().text);
+      xfm.p.y    = toFloat(tokens.next().text);
+      xfm.p.z    = toFloat(tokens.next().text);
+      float p_w  = toFloat(tokens.next().text);
       assert(p_w == 1.f);
 
-      const std::string close = *tokens.next();
+      const std::string close = tokens.next().text;
       assert(close == "]");
 
       return xfm;
     }
 
-    bool Parser::parseTransforms(std::shared_ptr<Token> token)
+    bool Parser::parseTransforms(const Token &token)
     {
-      if (token->text == "TransformBegin") {
+      switch (token.keyword) {
+      case KEYWORD_TRANSFORM_BEGIN: {
         pushTransform();
         return true;
       }
-      if (token->text == "TransformEnd") {
+      case KEYWORD_TRANSFORM_END: {
         popTransform();
         return true;
       }
-      if (token->text == "Scale") {
+      case KEYWORD_SCALE: {
         vec3f scale = parseVec3f(*tokens);
         addTransform(affine3f::scale(scale));
         return true;
       }
-      if (token->text == "Translate") {
+      case KEYWORD_TRANSLATE: {
         vec3f translate = parseVec3f(*tokens);
         addTransform(affine3f::translate(translate));
         return true;
       }
-      if (token->text == "ConcatTransform") {
+      case KEYWORD_CONCAT_TRANSFORM: {
         addTransform(parseMatrix(*tokens));
         return true;
       }
-      if (token->text == "Rotate") {
+      case KEYWORD_ROTATE: {
         const float angle = parseFloat(*tokens);
         const vec3f axis  = parseVec3f(*tokens);
         addTransform(affine3f::rotate(axis,angle*M_PI/180.f));
         return true;
       }
-      if (token->text == "Transform") {
+      case KEYWORD_TRANSFORM: {
         tokens->next(); // '['
         affine3f xfm;
         xfm.l.vx = parseVec3f(*tokens); tokens->next();
@@ -287,69 +575,96 @@ namespace pbrt_parser {
         addTransform(xfm);
         return true;
       }
-      if (token->text == "ActiveTransform") {
-        std::string time = tokens->next()->text;
-        std::cout << "'ActiveTransform' not implemented" << endl;
+      case KEYWORD_ACTIVE_TRANSFORM: {
+        std::string time = tokens->next().text;
+        log("'ActiveTransform' not implemented");
         return true;
       }
-      if (token->text == "Identity") {
+      case KEYWORD_IDENTITY: {
         setTransform(affine3f(ospcommon::one));
         return true;
       }
-      if (token->text == "ReverseOrientation") {
+      case KEYWORD_REVERSE_ORIENTATION: {
         /* according to the docs, 'ReverseOrientation' only flips the
            normals, not the actual transform */
         return true;
       }
-      if (token->text == "CoordSysTransform") {
-        std::shared_ptr<Token> nameOfObject = tokens->next();
-        cout << "ignoring 'CoordSysTransform'" << endl;
+      case KEYWORD_COORD_SYS_TRANSFORM: {
+        Token nameOfObject = tokens->next();
+        log("ignoring 'CoordSysTransform'");
         return true;
       }
-      return false;
+      default:
+        return false;
+      }
     }
 
     void Parser::parseWorld()
     {
-      cout << "Parsing PBRT World" << endl;
+      log("Parsing PBRT World");
       while (1) {
-        std::shared_ptr<Token> token = getNextToken();
-        assert(token);
-        if (token->text == "WorldEnd") {
-          cout << "Parsing PBRT World - done!" << endl;
-          break;
+        Token token = getNextToken();
+        if (!token)
+          throw std::runtime_error("unexpected end of file inside WorldBegin/WorldEnd");
+        switch (token.keyword) {
+        case KEYWORD_WORLD_END: {
+          log("Parsing PBRT World - done!");
+          return;
         }
         // -------------------------------------------------------
         // LightSource
         // -------------------------------------------------------
-        if (token->text == "LightSource") {
+        case KEYWORD_LIGHT_SOURCE: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
           std::shared_ptr<LightSource> lightSource
-            = std::make_shared<LightSource>(tokens->next()->text);
+            = std::make_shared<LightSource>(type);
           parseParams(lightSource->param,*tokens);
-          getCurrentObject()->lightSources.push_back(lightSource);
+          if (sink)
+            sink->onLightSource(lightSource,getCurrentXfm());
+          else
+            getCurrentObject()->lightSources.push_back(lightSource);
           continue;
         }
-        if (token->text == "AreaLightSource") {
+        case KEYWORD_AREA_LIGHT_SOURCE: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
           std::shared_ptr<AreaLightSource> lightSource
-            = std::make_shared<AreaLightSource>(tokens->next()->text);
+            = std::make_shared<AreaLightSource>(type);
           parseParams(lightSource->param,*tokens);
           continue;
         }
         // -------------------------------------------------------
         // Material
         // -------------------------------------------------------
-        if (token->text == "Material") {
-          std::string type = tokens->next()->text;
+        case KEYWORD_MATERIAL: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type)) {
+            /* rather than leaving the previous one active - unless
+               it's in a skipped object, which doesn't affect what
+               comes after it */
+            if (!inSkippedObject)
+              currentMaterial = nullptr;
+            continue;
+          }
           std::shared_ptr<Material> material
             = std::make_shared<Material>(type);
           parseParams(material->param,*tokens);
           currentMaterial = material;
+          if (sink)
+            sink->onMaterial("",material);
           continue;
         }
-        if (token->text == "Texture") {
-          std::string name = tokens->next()->text;
-          std::string texelType = tokens->next()->text;
-          std::string mapType = tokens->next()->text;
+        case KEYWORD_TEXTURE: {
+          std::string name = tokens->next().text;
+          if (skipStatement(token.keyword,name)) {
+            skippedTextures.insert(name);
+            continue;
+          }
+          const Symbol texelType = intern(tokens->next().text);
+          const Symbol mapType = intern(tokens->next().text);
           // if (mapType == "imagemap") {
           //   /* ok, everythng else are params */
           // } else if (mapType == "scale") {
@@ -357,142 +672,211 @@ namespace pbrt_parser {
           // }
           std::shared_ptr<Texture> texture
             = std::make_shared<Texture>(name,texelType,mapType);
-          attributesStack.top()->namedTexture[name] = texture;
+          modifyAttributes().namedTexture[name] = texture;
           parseParams(texture->param,*tokens);
+          if (sink)
+            sink->onTexture(texture);
           continue;
         }
-        if (token->text == "MakeNamedMaterial") {
-          std::string name = tokens->next()->text;
+        case KEYWORD_MAKE_NAMED_MATERIAL: {
+          std::string name = tokens->next().text;
+          if (skipStatement(token.keyword,name))
+            continue;
           std::shared_ptr<Material> material
-            = std::make_shared<Material>("<implicit>");
-          attributesStack.top()->namedMaterial[name] = material;
+            = std::make_shared<Material>(implicitMaterialType);
+          modifyAttributes().namedMaterial[name] = material;
           parseParams(material->param,*tokens);
 
           /* named material have the parameter type implicitly as a
              parameter rather than explicitly on the
              'makenamedmaterial' command; so let's parse this here */
-          std::shared_ptr<Param> type = material->param["type"];
+          const ParamList::Entry *type = material->param.find("type");
           if (!type) throw std::runtime_error("named material that does not specify a 'type' parameter!?");
-          std::shared_ptr<ParamT<std::string>> asString
-            = std::dynamic_pointer_cast<ParamT<std::string> >(type);
+          const ParamT<std::string> *asString = type->param->as<std::string>();
           if (!asString)
             throw std::runtime_error("named material has a type, but not a string!?");
           assert(asString->getSize() == 1);
-          material->type = asString->paramVec[0];
+          material->type = intern(asString->paramVec[0]);
+          if (sink)
+            sink->onMaterial(name,material);
           continue;
         }
 
-        if (token->text == "NamedMaterial") {
+        case KEYWORD_NAMED_MATERIAL: {
           // USE named material
-          std::string name = tokens->next()->text;
-          currentMaterial = attributesStack.top()->namedMaterial[name];
+          std::string name = tokens->next().text;
+          currentMaterial = attributesStack.top()->findNamedMaterial(name);
           continue;
         }
 
         // -------------------------------------------------------
         // Attributes
         // -------------------------------------------------------
-        if (token->text == "AttributeBegin") {
+        case KEYWORD_ATTRIBUTE_BEGIN: {
           pushAttributes();
           continue;
         }
-        if (token->text == "AttributeEnd") {
+        case KEYWORD_ATTRIBUTE_END: {
           popAttributes();
           continue;
         }
         // -------------------------------------------------------
         // Shapes
         // -------------------------------------------------------
-        if (token->text == "Shape") {
-          std::shared_ptr<Shape> shape
-            = std::make_shared<Shape>(tokens->next()->text,
-                                      currentMaterial,
-                                      attributesStack.top()->clone(),
-                                      transformStack.top());
-          parseParams(shape->param,*tokens);
-          getCurrentObject()->shapes.push_back(shape);
+        case KEYWORD_SHAPE: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
+          const int transformID = sink ? -1 : scene->transforms.insert(transformStack.top());
+          std::shared_ptr<Shape> shape;
+          if (type == triangleMeshType || type == plyMeshType) {
+            std::shared_ptr<TriangleMesh> mesh
+              = std::make_shared<TriangleMesh>(type,
+                                               currentMaterial,
+                                               attributesStack.top(),
+                                               transformID);
+            parseParams(mesh->param,*tokens);
+            setupTriangleMesh(*mesh);
+            shape = mesh;
+          } else {
+            shape = std::make_shared<Shape>(type,
+                                            currentMaterial,
+                                            attributesStack.top(),
+                                            transformID);
+            parseParams(shape->param,*tokens);
+          }
+          if (sink) {
+            sink->onShape(shape,transformStack.top());
+            /* unless the sink kept the shape, reuse its parameters
+               for the shapes that follow */
+            if (shape.use_count() == 1)
+              recycleParams(*shape);
+          } else
+            getCurrentObject()->shapes.push_back(shape);
           continue;
         }
         // -------------------------------------------------------
         // Volumes
         // -------------------------------------------------------
-        if (token->text == "Volume") {
+        case KEYWORD_VOLUME: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
           std::shared_ptr<Volume> volume
-            = std::make_shared<Volume>(tokens->next()->text);
+            = std::make_shared<Volume>(type);
           parseParams(volume->param,*tokens);
-          getCurrentObject()->volumes.push_back(volume);
+          if (sink) {
+            sink->onVolume(volume,transformStack.top());
+            if (volume.use_count() == 1)
+              recycleParams(*volume);
+          } else
+            getCurrentObject()->volumes.push_back(volume);
           continue;
         }
 
-        // -------------------------------------------------------
-        // Transforms
-        // -------------------------------------------------------
-        if (parseTransforms(token))
-          continue;
-        
-
         // -------------------------------------------------------
         // Objects
         // -------------------------------------------------------
 
-        if (token->text == "ObjectBegin") {
-          std::string name = tokens->next()->text;
+        case KEYWORD_OBJECT_BEGIN: {
+          std::string name = tokens->next().text;
+          if (skipStatement(token.keyword,name)) {
+            /* skip everything up to the matching ObjectEnd */
+            inSkippedObject = true;
+            skippedObjects.insert(name);
+            continue;
+          }
+          if (sink) {
+            sink->onObjectBegin(name);
+            continue;
+          }
           std::shared_ptr<Object> object = findNamedObject(name,1);
 
           objectStack.push(object);
-          // if (verbose)
-          //   cout << "pushing object " << object->toString() << endl;
+          // if (dbg)
+          //   log("pushing object "+object->toString());
           // transformStack.push(ospcommon::one);
           continue;
         }
           
-        if (token->text == "ObjectEnd") {
+        case KEYWORD_OBJECT_END: {
+          if (inSkippedObject) {
+            inSkippedObject = false;
+            continue;
+          }
+          if (sink) {
+            sink->onObjectEnd();
+            continue;
+          }
           objectStack.pop();
           // transformStack.pop();
           continue;
         }
 
-        if (token->text == "ObjectInstance") {
-          std::string name = tokens->next()->text;
+        case KEYWORD_OBJECT_INSTANCE: {
+          std::string name = tokens->next().text;
+          if (skippedObjects.count(name) || skipStatement(token.keyword,name))
+            continue;
+          if (sink) {
+            sink->onInstance(name,getCurrentXfm());
+            continue;
+          }
           std::shared_ptr<Object> object = findNamedObject(name,1);
           std::shared_ptr<Object::Instance> inst
-            = std::make_shared<Object::Instance>(object,getCurrentXfm());
+            = std::make_shared<Object::Instance>(object,scene->transforms.insert(getCurrentXfm()));
           getCurrentObject()->objectInstances.push_back(inst);
-          if (verbose)
-            cout << "adding instance " << inst->toString()
-                 << " to object " << getCurrentObject()->toString() << endl;
+          if (dbg)
+            log("adding instance "+inst->toString()
+                +" to object "+getCurrentObject()->toString());
           continue;
         }
+        default:
+          break;
+        }
+
+        // -------------------------------------------------------
+        // Transforms
+        // -------------------------------------------------------
+        if (parseTransforms(token))
+          continue;
           
         // -------------------------------------------------------
         // ERROR - unrecognized token in worldbegin/end!!!
         // -------------------------------------------------------
-        throw std::runtime_error("unexpected token '"+token->text
-                                 +"' at "+token->loc.toString());
+        throw std::runtime_error("unexpected token '"+token.text.str()
+                                 +"' at "+token.loc.toString());
       }
     }
 
-    std::shared_ptr<Token> Parser::getNextToken()
+    Token Parser::getNextToken()
     {
-      std::shared_ptr<Token> token = tokens->next();
+      Token token = tokens->next();
       while (!token) {
         if (tokenizerStack.empty())
-          return std::shared_ptr<Token>();
+          return Token();
+        secondsBlockedOnInput += tokens->getFile().getSecondsBlocked();
         tokens = tokenizerStack.top();
         tokenizerStack.pop();
         token = tokens->next();
       }
       assert(token);
-      if (token->text == "Include") {
-        std::shared_ptr<Token> fileNameToken = tokens->next();
-        FileName includedFileName = fileNameToken->text;
+      if (token.keyword == KEYWORD_INCLUDE) {
+        Token fileNameToken = tokens->next();
+        FileName includedFileName = fileNameToken.text.str();
         if (includedFileName.str()[0] != '/') {
           includedFileName = rootNamePath+includedFileName;
         }
-        cout << "... including file '" << includedFileName.str() << " ..." << endl;
+        log("... including file '"+includedFileName.str()+" ...");
         
+        std::shared_ptr<Lexer> included
+          = includeResolver
+          ? includeResolver(includedFileName.str(),lexerConfig)
+          : std::make_shared<Lexer>(includedFileName,lexerConfig);
+        if (!included)
+          throw std::runtime_error("could not resolve include '"+includedFileName.str()
+                                   +"' at "+fileNameToken.loc.toString());
         tokenizerStack.push(tokens);
-        tokens = std::make_shared<Lexer>(includedFileName);
+        tokens = included;
         return getNextToken();
       }
       else
@@ -502,12 +886,12 @@ namespace pbrt_parser {
     void Parser::parseScene()
     {
       while (1) {
-        std::shared_ptr<Token> token = getNextToken();
+        Token token = getNextToken();
         if (!token)
           break;
 
         if (dbg) 
-          cout << token->toString() << endl;
+          log(token.toString());
 
         // -------------------------------------------------------
         // Transforms
@@ -515,12 +899,12 @@ namespace pbrt_parser {
         if (parseTransforms(token))
           continue;
         
-
-        if (token->text == "ConcatTransform") {
+        switch (token.keyword) {
+        case KEYWORD_CONCAT_TRANSFORM: {
           tokens->next(); // '['
           float mat[16];
           for (int i=0;i<16;i++)
-            mat[i] = atof(tokens->next()->text.c_str());
+            mat[i] = toFloat(tokens->next().text);
 
           affine3f xfm;
           xfm.l.vx = vec3f(mat[0],mat[1],mat[2]);
@@ -532,113 +916,193 @@ namespace pbrt_parser {
           tokens->next(); // ']'
           continue;
         }
-        if (token->text == "CoordSysTransform") {
-          std::string transformType = tokens->next()->text;
+        case KEYWORD_COORD_SYS_TRANSFORM: {
+          std::string transformType = tokens->next().text;
           continue;
         }
 
 
-        if (token->text == "ActiveTransform") {
-          std::string time = tokens->next()->text;
+        case KEYWORD_ACTIVE_TRANSFORM: {
+          std::string time = tokens->next().text;
           continue;
         }
 
-        if (token->text == "LookAt") {
+        case KEYWORD_LOOK_AT: {
           vec3f v0 = parseVec3f(*tokens);
           vec3f v1 = parseVec3f(*tokens);
           vec3f v2 = parseVec3f(*tokens);
           scene->lookAt = std::make_shared<LookAt>(v0,v1,v2);
           continue;
         }
-        if (token->text == "Camera") {
-          std::shared_ptr<Camera> camera = std::make_shared<Camera>(tokens->next()->text);
+        case KEYWORD_CAMERA: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
+          std::shared_ptr<Camera> camera = std::make_shared<Camera>(type);
           parseParams(camera->param,*tokens);
-          scene->cameras.push_back(camera);
+          if (sink)
+            sink->onCamera(camera,getCurrentXfm());
+          else
+            scene->cameras.push_back(camera);
           continue;
         }
-        if (token->text == "Sampler") {
-          std::shared_ptr<Sampler> sampler = std::make_shared<Sampler>(tokens->next()->text);
+        case KEYWORD_SAMPLER: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
+          std::shared_ptr<Sampler> sampler = std::make_shared<Sampler>(type);
           parseParams(sampler->param,*tokens);
           scene->sampler = sampler;
           continue;
         }
-        if (token->text == "Integrator") {
-          std::shared_ptr<Integrator> integrator = std::make_shared<Integrator>(tokens->next()->text);
+        case KEYWORD_INTEGRATOR: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
+          std::shared_ptr<Integrator> integrator = std::make_shared<Integrator>(type);
           parseParams(integrator->param,*tokens);
           scene->integrator = integrator;
           continue;
         }
-        if (token->text == "SurfaceIntegrator") {
+        case KEYWORD_SURFACE_INTEGRATOR: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
           std::shared_ptr<SurfaceIntegrator> surfaceIntegrator
-            = std::make_shared<SurfaceIntegrator>(tokens->next()->text);
+            = std::make_shared<SurfaceIntegrator>(type);
           parseParams(surfaceIntegrator->param,*tokens);
           scene->surfaceIntegrator = surfaceIntegrator;
           continue;
         }
-        if (token->text == "VolumeIntegrator") {
+        case KEYWORD_VOLUME_INTEGRATOR: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
           std::shared_ptr<VolumeIntegrator> volumeIntegrator
-            = std::make_shared<VolumeIntegrator>(tokens->next()->text);
+            = std::make_shared<VolumeIntegrator>(type);
           parseParams(volumeIntegrator->param,*tokens);
           scene->volumeIntegrator = volumeIntegrator;
           continue;
         }
-        if (token->text == "PixelFilter") {
-          std::shared_ptr<PixelFilter> pixelFilter = std::make_shared<PixelFilter>(tokens->next()->text);
+        case KEYWORD_PIXEL_FILTER: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
+          std::shared_ptr<PixelFilter> pixelFilter = std::make_shared<PixelFilter>(type);
           parseParams(pixelFilter->param,*tokens);
           scene->pixelFilter = pixelFilter;
           continue;
         }
-        if (token->text == "Accelerator") {
-          std::shared_ptr<Accelerator> accelerator = std::make_shared<Accelerator>(tokens->next()->text);
+        case KEYWORD_ACCELERATOR: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
+          std::shared_ptr<Accelerator> accelerator = std::make_shared<Accelerator>(type);
           parseParams(accelerator->param,*tokens);
           continue;
         }
-        if (token->text == "Film") {
-          std::shared_ptr<Film> film = std::make_shared<Film>(tokens->next()->text);
+        case KEYWORD_FILM: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
+          std::shared_ptr<Film> film = std::make_shared<Film>(type);
           parseParams(film->param,*tokens);
           continue;
         }
-        if (token->text == "Accelerator") {
-          std::shared_ptr<Accelerator> accelerator = std::make_shared<Accelerator>(tokens->next()->text);
-          parseParams(accelerator->param,*tokens);
-          continue;
-        }
-        if (token->text == "Renderer") {
-          std::shared_ptr<Renderer> renderer = std::make_shared<Renderer>(tokens->next()->text);
+        case KEYWORD_RENDERER: {
+          const Symbol type = intern(tokens->next().text);
+          if (skipStatement(token.keyword,type))
+            continue;
+          std::shared_ptr<Renderer> renderer = std::make_shared<Renderer>(type);
           parseParams(renderer->param,*tokens);
           continue;
         }
 
-        if (token->text == "WorldBegin") {
+        case KEYWORD_WORLD_BEGIN: {
           setTransform(affine3f(ospcommon::one));
           parseWorld();
           continue;
         }
 
-        if (token->text == "Material") {
+        case KEYWORD_MATERIAL: {
           throw std::runtime_error("'Material' field not within a WorldBegin/End context. "
                                    "Did you run the parser on the 'geometry.pbrt' file directly? "
                                    "(you shouldn't - it should only be included from within a "
                                    "pbrt scene file - typically '*.view')");
           continue;
         }
-
+        default:
+          break;
+        }
         
-        throw std::runtime_error("unexpected token '"+token->text
-                                 +"' at "+token->loc.toString());
+        throw std::runtime_error("unexpected token '"+token.text.str()
+                                 +"' at "+token.loc.toString());
       }
     }
 
     
     /*! parse given file, and add it to the scene we hold */
     void Parser::parse(const FileName &fn)
+    {
+      parse(fn,std::make_shared<Lexer>(fn,lexerConfig));
+    }
+
+    void Parser::parse(const std::string &name, const char *text, size_t size)
+    {
+      parse(name,std::make_shared<Lexer>(name,text,size,lexerConfig));
+    }
+
+    void Parser::parse(const std::string &name, std::istream &in)
+    {
+      parse(name,std::make_shared<Lexer>(name,in,lexerConfig));
+    }
+
+    void Parser::parse(const FileName &fn, const std::shared_ptr<Lexer> &lexer)
     {
       rootNamePath
         = basePath==""
         ? (std::string)fn.path()
         : (std::string)FileName(basePath);
-      this->tokens = std::make_shared<Lexer>(fn);
+      this->tokens = lexer;
       parseScene();      
+      secondsBlockedOnInput += tokens->getFile().getSecondsBlocked();
     }
 
+  std::vector<std::shared_ptr<Scene> >
+  parseScenes(const std::vector<std::string> &fileNames,
+              int numThreads,
+              const std::function<void(Parser &)> &configure)
+  {
+    const size_t numFiles = fileNames.size();
+    if (numThreads <= 0)
+      numThreads = std::max(1,(int)std::thread::hardware_concurrency());
+    numThreads = (int)std::min((size_t)numThreads,numFiles);
+
+    std::vector<std::shared_ptr<Scene> > scenes(numFiles);
+    std::vector<std::exception_ptr>      errors(numFiles);
+    std::atomic<size_t>                  nextFile(0);
+    auto work = [&]() {
+      for (size_t fileID = nextFile++; fileID < numFiles; fileID = nextFile++) {
+        try {
+          Parser parser(false);
+          if (configure) configure(parser);
+          parser.parse(fileNames[fileID]);
+          scenes[fileID] = parser.getScene();
+        } catch (...) {
+          errors[fileID] = std::current_exception();
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int i=1;i<numThreads;i++)
+      threads.push_back(std::thread(work));
+    work();
+    for (auto &thread : threads)
+      thread.join();
+
+    for (auto &error : errors)
+      if (error) std::rethrow_exception(error);
+    return scenes;
+  }
+
 } // ::pbrt_parser
@@ -17,14 +17,16 @@
 #pragma once
 
 #include "pbrt/Scene.h"
+#include "pbrt/Lexer.h"
+#include "pbrt/SceneSink.h"
 // std
 #include <stack>
+#include <functional>
+#include <unordered_map>
+#include <set>
 
 namespace pbrt_parser {
 
-  struct Lexer;
-  struct Token;
-
   /*! parser object that holds persistent state about the parsing
     state (e.g., file paths, named objects, etc), even if they are
     split over multiple files. To parse different scenes, use
@@ -35,6 +37,14 @@ namespace pbrt_parser {
 
     /*! parse given file, and add it to the scene we hold */
     void parse(const FileName &fn);
+    /*! parse the scene text in given memory region, and add it to the
+      scene we hold. the text does not get copied, and has to stay
+      valid while parsing. 'name' is what error messages refer to,
+      and what relative includes get resolved against */
+    void parse(const std::string &name, const char *text, size_t size);
+    /*! parse the scene text read from given stream, and add it to the
+      scene we hold */
+    void parse(const std::string &name, std::istream &in);
 
     /*! parse everything in WorldBegin/WorldEnd */
     void parseWorld();
@@ -46,20 +56,82 @@ namespace pbrt_parser {
       
     /*! try parsing this token as some sort of transform token, and
       return true if successful, false if not recognized  */
-    bool parseTransforms(std::shared_ptr<Token> token);
+    bool parseTransforms(const Token &token);
 
     void pushTransform();
     void popTransform();
 
     std::map<std::string,std::shared_ptr<Object> >   namedObjects;
 
-    inline std::shared_ptr<Param> parseParam(std::string &name, Lexer &tokens);
-    void parseParams(std::map<std::string, std::shared_ptr<Param> > &params, Lexer &tokens);
+    /*! parse one parameter (if there is one), setting 'name' to its
+      (interned) name */
+    inline std::shared_ptr<Param> parseParam(Symbol &name, Lexer &tokens);
+    void parseParams(ParamList &params, Lexer &tokens);
+    /*! for lazyArrays: if the (just opened) list of values is a
+      large, plain list of numbers, consume it, and have the
+      parameter decode it later; returns false if it doesn't get
+      skipped */
+    template<typename T>
+    inline bool skipArray(ParamT<T> &param, Lexer &tokens);
+    /*! move the given node's parameters (those nobody else holds on
+      to) into our pool of parameters to reuse */
+    void recycleParams(Parameterized &node);
+
+    /*! how to read and lex the input files */
+    LexerConfig lexerConfig;
+    /*! opens the file named in an 'Include' statement (relative names
+      already prefixed with the scene's base path). if not set,
+      included files get read from disk; set this to pull them from
+      memory, archives, etc instead - eg, by returning a
+      std::make_shared<Lexer>(fileName,data,size,config) */
+    std::function<std::shared_ptr<Lexer>(const std::string &fileName,
+                                         const LexerConfig &config)> includeResolver;
+    /*! if set, the parser hands the scene's entities to this sink as
+      it parses them, rather than adding them to its scene */
+    std::shared_ptr<SceneSink> sink;
+    /*! receives the parser's status (and, with 'dbg', debug)
+      messages, one line per call. defaults to printing to
+      std::cout; set to null to silence the parser */
+    std::function<void(const std::string &message)> logSink;
+    /*! if set, large numeric parameter arrays (such as the vertices
+      and indices of meshes) don't get decoded while parsing: they
+      only get recorded as ranges of the input file's chars, and get
+      decoded on first access through findParam/getParam*, so
+      geometry nobody looks at costs only a scan (triangle meshes then
+      only get built, and ply files loaded, by TriangleMesh::load()).
+      only applies to mapped (and plain in-memory) files that get
+      lexed by a single thread; note that in-memory data then has to
+      stay valid until everything got decoded */
+    bool lazyArrays;
+    /*! max number of threads to decode each lazy array with (0 for
+      'all cores') */
+    int lazyArrayThreads;
+    /*! if set, only the statements this accepts get parsed; all
+      others get skipped at lexer speed (no tokens, no numbers
+      decoded), yielding a partial scene. it gets asked about each
+      statement that defines something - Camera, Film, Sampler,
+      Integrator (and its variants), PixelFilter, Accelerator,
+      Renderer, LightSource, AreaLightSource, Material,
+      MakeNamedMaterial, Texture, Shape, Volume, ObjectBegin and
+      ObjectInstance - along with its first argument: the type of
+      camera, light, material, shape etc, or the name of the texture,
+      named material or object. rejecting an ObjectBegin skips the
+      whole object, including all instances of it. statements that
+      only change the parser's state (transforms, attributes,
+      NamedMaterial, ...) always get processed. texture parameters
+      that refer to a skipped texture are null */
+    std::function<bool(Keyword statement, const std::string &argument)> filter;
+    /*! total time (in seconds) the lexer(s) were blocked waiting for
+      streamed input */
+    double secondsBlockedOnInput;
 
     /*! return the scene we have parsed */
     std::shared_ptr<Scene> getScene() { return scene; }
     std::shared_ptr<Texture> getTexture(const std::string &name);
   private:
+    /*! parse the root scene file read by given lexer */
+    void parse(const FileName &fn, const std::shared_ptr<Lexer> &lexer);
+
     //! stack of parent files' token streams
     std::stack<std::shared_ptr<Lexer> > tokenizerStack;
     //! token stream of currently open file
@@ -67,7 +139,9 @@ namespace pbrt_parser {
     /*! get the next token to process (either from current file, or
       parent file(s) if current file is EOL!); return NULL if
       complete end of input */
-    std::shared_ptr<Token> getNextToken();
+    Token getNextToken();
+
+    void log(const std::string &message) { if (logSink) logSink(message); }
 
     // add additional transform to current transform
     void addTransform(const affine3f &add)
@@ -77,6 +151,38 @@ namespace pbrt_parser {
     void setTransform(const affine3f &xfm)
     { transformStack.top() = xfm; }
 
+    /*! return the symbol for given name or type, caching what we
+      looked up so far so we only rarely need the global (locked)
+      symbol table */
+    Symbol intern(const TextView &text);
+    std::unordered_map<TextView,Symbol,TextView::Hash> symbols;
+
+    /*! parameters of entities handed to (and released by) the sink,
+      for reuse, by parameter type */
+    std::vector<std::vector<std::shared_ptr<Param> > > recycledParams;
+    /*! the floats of the vector parameter being parsed */
+    AlignedVector<float> components;
+
+    /*! fill in the geometry of a just parsed 'trianglemesh' or
+      'plymesh' - or, with lazyArrays, have its load() do so */
+    void setupTriangleMesh(TriangleMesh &mesh);
+
+    /*! if the filter rejects the given statement (whose keyword and
+      first argument have just been read), or we're in a skipped
+      object, skip the rest of the statement and return true */
+    inline bool skipStatement(Keyword statement, const std::string &argument);
+    /*! whether we're inside an object the filter rejected */
+    bool                  inSkippedObject;
+    /*! names of the objects the filter rejected */
+    std::set<std::string> skippedObjects;
+    /*! names of the textures the filter rejected; references to
+      those get a null texture, rather than an error */
+    std::set<std::string> skippedTextures;
+
+    /*! return the current attributes, for adding a definition to
+      them - which requires a new version if they're shared */
+    Attributes &modifyAttributes();
+
     std::stack<std::shared_ptr<Material> >   materialStack;
     std::stack<std::shared_ptr<Attributes> > attributesStack;
     std::stack<affine3f>                     transformStack;
@@ -95,8 +201,25 @@ namespace pbrt_parser {
     std::shared_ptr<Material> currentMaterial;
   };
 
+  /*! parse each of the given scene files with a parser of its own,
+    using up to 'numThreads' threads (<= 0: one per core), and return
+    their scenes, in the same order. 'configure', if set, gets called
+    on each parser before it starts (eg, to set its lexer config or
+    log sink), possibly from several threads at once. if any file
+    fails to parse, throws the error of the first such file */
+  PBRT_PARSER_INTERFACE std::vector<std::shared_ptr<Scene> >
+  parseScenes(const std::vector<std::string> &fileNames,
+              int numThreads = 0,
+              const std::function<void(Parser &)> &configure = nullptr);
+
   PBRT_PARSER_INTERFACE void parsePLY(const std::string &fileName,
                                       std::vector<vec3f> &v,
                                       std::vector<vec3f> &n,
                                       std::vector<vec3i> &idx);
+  /*! same, but straight into aligned arrays (such as those of a
+    TriangleMesh) */
+  PBRT_PARSER_INTERFACE void parsePLY(const std::string &fileName,
+                                      AlignedVector<vec3f> &v,
+                                      AlignedVector<vec3f> &n,
+                                      AlignedVector<vec3i> &idx);
 }
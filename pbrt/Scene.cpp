@@ -15,9 +15,13 @@
 // ======================================================================== //
 
 #include "Scene.h"
+#include "Number.h"
+#include "CharClass.h"
 // std
 #include <iostream>
 #include <sstream>
+#include <thread>
+#include <algorithm>
 
 namespace pbrt_parser {
 
@@ -41,35 +45,194 @@ namespace pbrt_parser {
   std::string Object::Instance::toString() const
   { 
     std::stringstream ss;
-    ss << "Inst: " << object->toString() << " xfm " << xfm; 
+    ss << "Inst: " << object->toString() << " xfm #" << transformID; 
     return ss.str();
   }
 
+  // ==================================================================
+  // TransformTable
+  // ==================================================================
+
+  static_assert(sizeof(affine3f) == 12*sizeof(float),
+                "transforms get hashed and compared bitwise, so must not have padding");
+
+  /*! hash of the bits of given transform */
+  inline uint32_t hashTransform(const affine3f &transform)
+  {
+    uint32_t bits[sizeof(affine3f)/sizeof(uint32_t)];
+    memcpy(bits,&transform,sizeof(bits));
+    uint32_t h = 2166136261u;
+    for (uint32_t b : bits)
+      h = (h ^ b) * 16777619u;
+    return h ^ (h >> 15);
+  }
+
+  TransformTable::TransformTable()
+    : slots(16), lastIndex(-1)
+  {
+    insert(affine3f(one));
+  }
+
+  int TransformTable::insert(const affine3f &transform)
+  {
+    /* consecutive shapes very often share the same transform */
+    if (lastIndex >= 0 &&
+        memcmp(&transforms[lastIndex],&transform,sizeof(transform)) == 0)
+      return lastIndex;
+
+    const uint32_t hash = hashTransform(transform);
+    const size_t mask = slots.size()-1;
+    size_t slot = hash & mask;
+    while (slots[slot].index >= 0) {
+      if (slots[slot].hash == hash &&
+          memcmp(&transforms[slots[slot].index],&transform,sizeof(transform)) == 0)
+        return lastIndex = slots[slot].index;
+      slot = (slot+1) & mask;
+    }
+    const int index = (int)transforms.size();
+    transforms.push_back(transform);
+    slots[slot].hash  = hash;
+    slots[slot].index = index;
+
+    if (2*transforms.size() > slots.size()) {
+      /* keep the table at most half full */
+      std::vector<Slot> grown(2*slots.size());
+      const size_t grownMask = grown.size()-1;
+      for (const Slot &old : slots) {
+        if (old.index < 0) continue;
+        size_t s = old.hash & grownMask;
+        while (grown[s].index >= 0) s = (s+1) & grownMask;
+        grown[s] = old;
+      }
+      slots.swap(grown);
+    }
+    return lastIndex = index;
+  }
+
+  // ==================================================================
+  // lazily parsed parameter values
+  // ==================================================================
+
+  /*! texts shorter than this many bytes per thread get decoded by
+    fewer threads */
+  static const size_t MIN_PARALLEL_DECODE_SIZE = 1<<20;
+
+  inline void decodeNumber(const char *begin, const char *end, float &value)
+  { scanFloat(begin,end,value); }
+  inline void decodeNumber(const char *begin, const char *end, int &value)
+  { scanInt(begin,end,value); }
+
+  /*! decode the numbers in [begin,end) into 'out' */
+  template<typename T>
+  static void decodeRange(const char *begin, const char *end, T *out)
+  {
+    while ((begin = skipWhite(begin,end)) < end) {
+      const char *numberEnd = findDelimiter(begin,end);
+      decodeNumber(begin,numberEnd,*out++);
+      begin = numberEnd;
+    }
+  }
+
+  /*! decode into Vs that consist of (one or more) Ts */
+  template<typename T, typename V>
+  static void decodeValuesT(const TextView &text, int numThreads, AlignedVector<V> &values)
+  {
+    static const size_t N = sizeof(V)/sizeof(T);
+    static_assert(sizeof(V) == N*sizeof(T),"vector types must not have padding");
+    const char *begin = text.begin;
+    const char *end   = text.end();
+    if (numThreads <= 0)
+      numThreads = std::max((int)std::thread::hardware_concurrency(),1);
+    const size_t numChunks
+      = std::max(std::min((size_t)numThreads,text.size/MIN_PARALLEL_DECODE_SIZE),(size_t)1);
+
+    /* split into chunks at white space, and find out where in
+       'values' each chunk's numbers go */
+    std::vector<const char *> bounds(numChunks+1);
+    bounds[0]         = begin;
+    bounds[numChunks] = end;
+    for (size_t i=1;i<numChunks;i++) {
+      const char *b = std::max(begin+text.size*i/numChunks,bounds[i-1]);
+      while (b < end && !isWhite(*b)) ++b;
+      bounds[i] = b;
+    }
+    std::vector<size_t> offsets(numChunks+1,0);
+    for (size_t i=0;i<numChunks;i++)
+      offsets[i+1] = offsets[i]+countWords(bounds[i],bounds[i+1]);
+
+    if (offsets[numChunks] % N)
+      throw std::runtime_error("number of values ("+std::to_string(offsets[numChunks])
+                               +") isn't a multiple of "+std::to_string(N));
+    values.resize(offsets[numChunks]/N);
+    T *out = (T *)values.data();
+    if (numChunks == 1) {
+      decodeRange(begin,end,out);
+      return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i=1;i<numChunks;i++)
+      threads.push_back(std::thread([&,i]() {
+            decodeRange(bounds[i],bounds[i+1],out+offsets[i]);
+          }));
+    decodeRange(bounds[0],bounds[1],out);
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  void decodeValues(const TextView &text, int numThreads, AlignedVector<float> &values)
+  { decodeValuesT<float>(text,numThreads,values); }
+
+  void decodeValues(const TextView &text, int numThreads, AlignedVector<vec3f> &values)
+  { decodeValuesT<float>(text,numThreads,values); }
+
+  void decodeValues(const TextView &text, int numThreads, AlignedVector<vec2f> &values)
+  { decodeValuesT<float>(text,numThreads,values); }
+
+  void decodeValues(const TextView &text, int numThreads, AlignedVector<int> &values)
+  { decodeValuesT<int>(text,numThreads,values); }
+
   // ==================================================================
   // Param
   // ==================================================================
-  template<> void ParamT<float>::add(const std::string &text)
-  { paramVec.push_back(atof(text.c_str())); }
+  const char *paramTypeName(ParamType type)
+  {
+    static const char *const names[NUM_PARAM_TYPES] = {
+      "float", "rgb", "texture", "string", "integer", "point", "color",
+      "bool", "normal", "spectrum", "point2", "point3", "point4", "vector"
+    };
+    return (unsigned)type < NUM_PARAM_TYPES ? names[type] : "<invalid>";
+  }
+
+  template<> void ParamT<float>::add(const TextView &text)
+  { paramVec.push_back(toFloat(text)); }
 
-  template<> void ParamT<int>::add(const std::string &text)
-  { paramVec.push_back(atoi(text.c_str())); }
+  /*! vector values get set all at once, by the parser */
+  template<> void ParamT<vec3f>::add(const TextView &text)
+  { throw std::runtime_error("should never get called.."); }
 
-  template<> void ParamT<std::string>::add(const std::string &text)
+  template<> void ParamT<vec2f>::add(const TextView &text)
+  { throw std::runtime_error("should never get called.."); }
+
+  template<> void ParamT<int>::add(const TextView &text)
+  { paramVec.push_back(toInt(text)); }
+
+  template<> void ParamT<std::string>::add(const TextView &text)
   { paramVec.push_back(text); }
 
-  template<> void ParamT<bool>::add(const std::string &text)
+  template<> void ParamT<bool>::add(const TextView &text)
   { 
     if (text == "true")
       paramVec.push_back(true); 
     else if (text == "false")
       paramVec.push_back(false); 
     else
-      throw std::runtime_error("invalid value '"+text+"' for bool parameter");
+      throw std::runtime_error("invalid value '"+text.str()+"' for bool parameter");
   }
 
 
   template<> std::string ParamT<float>::toString() const
   { 
+    decode();
     std::stringstream ss;
     ss << getType() << " ";
     ss << "[ ";
@@ -79,6 +242,30 @@ namespace pbrt_parser {
     return ss.str();
   }
 
+  template<> std::string ParamT<vec3f>::toString() const
+  { 
+    decode();
+    std::stringstream ss;
+    ss << getType() << " ";
+    ss << "[ ";
+    for (const vec3f &v : paramVec)
+      ss << v.x << " " << v.y << " " << v.z << " ";
+    ss << "]";
+    return ss.str();
+  }
+
+  template<> std::string ParamT<vec2f>::toString() const
+  { 
+    decode();
+    std::stringstream ss;
+    ss << getType() << " ";
+    ss << "[ ";
+    for (const vec2f &v : paramVec)
+      ss << v.x << " " << v.y << " ";
+    ss << "]";
+    return ss.str();
+  }
+
   std::string ParamT<Texture>::toString() const
   { 
     std::stringstream ss;
@@ -102,6 +289,7 @@ namespace pbrt_parser {
 
   template<> std::string ParamT<int>::toString() const
   { 
+    decode();
     std::stringstream ss;
     ss << getType() << " ";
     ss << "[ ";
@@ -123,95 +311,186 @@ namespace pbrt_parser {
   }
 
   template struct ParamT<float>;
+  template struct ParamT<vec3f>;
+  template struct ParamT<vec2f>;
   template struct ParamT<int>;
   template struct ParamT<bool>;
   template struct ParamT<std::string>;
 
+  // ==================================================================
+  // ParamList
+  // ==================================================================
+  void ParamList::set(const Symbol &name, const std::shared_ptr<Param> &param)
+  {
+    for (Entry &entry : entries)
+      if (entry.name == name) {
+        entry.param = param;
+        return;
+      }
+    entries.push_back({name,param});
+  }
+
+  void ParamList::erase(const TextView &name)
+  {
+    if (const Entry *entry = find(name))
+      entries.erase(entries.begin()+(entry-entries.data()));
+  }
+
   // ==================================================================
   // Parameterized
   // ==================================================================
-  vec3f Parameterized::getParam3f(const std::string &name, const vec3f &fallBack) const
+
+  /*! the (decoded) parameter of given name, after checking it's got
+    the right type and number of values; null if there's no such
+    parameter */
+  template<typename T>
+  inline const ParamT<T> *findParamChecked(const ParamList &params,
+                                           const TextView &name,
+                                           size_t numValues)
   {
-    std::map<std::string,std::shared_ptr<Param> >::const_iterator it=param.find(name);
-    if (it == param.end())
-      return fallBack;
-    std::shared_ptr<Param> pr = it->second;
-    const std::shared_ptr<ParamT<float>> p = std::dynamic_pointer_cast<ParamT<float>>(pr);
+    const ParamList::Entry *entry = params.find(name);
+    if (!entry)
+      return nullptr;
+    const ParamT<T> *p = entry->param->as<T>();
     if (!p)
       throw std::runtime_error("found param of given name, but of wrong type!");
-    if (p->getSize() != 3)
+    p->decode();
+    if (p->paramVec.size() != numValues)
       throw std::runtime_error("found param of given name and type, but wrong number of components!");
-    return vec3f(p->paramVec[0],p->paramVec[1],p->paramVec[2]);
+    return p;
   }
 
-  float Parameterized::getParam1f(const std::string &name, const float fallBack) const
+  vec3f Parameterized::getParam3f(const TextView &name, const vec3f &fallBack) const
   {
-    std::map<std::string,std::shared_ptr<Param> >::const_iterator it=param.find(name);
-    if (it == param.end())
-      return fallBack;
-    std::shared_ptr<Param> pr = it->second;
-    const std::shared_ptr<ParamT<float>> p = std::dynamic_pointer_cast<ParamT<float>>(pr);
+    const ParamList::Entry *entry = param.find(name);
+    if (entry && entry->param->storage == PARAM_STORAGE_VEC3F)
+      return findParamChecked<vec3f>(param,name,1)->paramVec[0];
+    /* also take three values of a plain float parameter */
+    const ParamT<float> *p = findParamChecked<float>(param,name,3);
     if (!p)
-      throw std::runtime_error("found param of given name, but of wrong type!");
-    if (p->getSize() != 1)
-      throw std::runtime_error("found param of given name and type, but wrong number of components!");
-    return p->paramVec[0];
+      return fallBack;
+    return vec3f(p->paramVec[0],p->paramVec[1],p->paramVec[2]);
   }
 
-  int Parameterized::getParam1i(const std::string &name, const int fallBack) const
+  float Parameterized::getParam1f(const TextView &name, const float fallBack) const
   {
-    std::map<std::string,std::shared_ptr<Param> >::const_iterator it=param.find(name);
-    if (it == param.end())
-      return fallBack;
-    std::shared_ptr<Param> pr = it->second;
-    const std::shared_ptr<ParamT<int>> p = std::dynamic_pointer_cast<ParamT<int>>(pr);
-    if (!p)
-      throw std::runtime_error("found param of given name, but of wrong type!");
-    if (p->getSize() != 1)
-      throw std::runtime_error("found param of given name and type, but wrong number of components!");
-    return p->paramVec[0];
+    const ParamT<float> *p = findParamChecked<float>(param,name,1);
+    return p ? p->paramVec[0] : fallBack;
   }
 
-  std::string Parameterized::getParamString(const std::string &name) const
+  int Parameterized::getParam1i(const TextView &name, const int fallBack) const
   {
-    std::map<std::string,std::shared_ptr<Param> >::const_iterator it=param.find(name);
-    if (it == param.end())
-      return "";
-    std::shared_ptr<Param> pr = it->second;
-    const std::shared_ptr<ParamT<std::string>> p = std::dynamic_pointer_cast<ParamT<std::string>>(pr);
-    if (!p)
-      throw std::runtime_error("found param of given name, but of wrong type!");
-    if (p->getSize() != 1)
-      throw std::runtime_error("found param of given name and type, but wrong number of components!");
-    return p->paramVec[0];
+    const ParamT<int> *p = findParamChecked<int>(param,name,1);
+    return p ? p->paramVec[0] : fallBack;
   }
 
-  std::shared_ptr<Texture> Parameterized::getParamTexture(const std::string &name) const
+  std::string Parameterized::getParamString(const TextView &name) const
   {
-    std::map<std::string,std::shared_ptr<Param> >::const_iterator it=param.find(name);
-    if (it == param.end())
+    const ParamT<std::string> *p = findParamChecked<std::string>(param,name,1);
+    return p ? p->paramVec[0] : "";
+  }
+
+  std::shared_ptr<Texture> Parameterized::getParamTexture(const TextView &name) const
+  {
+    const ParamList::Entry *entry = param.find(name);
+    if (!entry)
       return std::shared_ptr<Texture>();
-    std::shared_ptr<Param> pr = it->second;
-    const std::shared_ptr<ParamT<Texture>> p = std::dynamic_pointer_cast<ParamT<Texture>>(pr);
+    const ParamT<Texture> *p = entry->param->as<Texture>();
     if (!p)
       throw std::runtime_error("found param of given name, but of wrong type!");
-    if (p->getSize() != 1)
-      throw std::runtime_error("found param of given name and type, but wrong number of components!");
     return p->texture;
   }
 
-  bool Parameterized::getParamBool(const std::string &name, const bool fallBack) const
+  bool Parameterized::getParamBool(const TextView &name, const bool fallBack) const
   {
-    std::map<std::string,std::shared_ptr<Param> >::const_iterator it=param.find(name);
-    if (it == param.end())
-      return fallBack;
-    std::shared_ptr<Param> pr = it->second;
-    const std::shared_ptr<ParamT<bool>> p = std::dynamic_pointer_cast<ParamT<bool>>(pr);
+    const ParamT<bool> *p = findParamChecked<bool>(param,name,1);
+    return p ? p->paramVec[0] : fallBack;
+  }
+
+  /*! the values of given parameter, viewed as an array of Vs that
+    consist of Ts */
+  template<typename V, typename T>
+  inline ArrayView<V> getArrayView(const ParamList &params, const TextView &name)
+  {
+    static const size_t N = sizeof(V)/sizeof(T);
+    static_assert(sizeof(V) == N*sizeof(T),
+                  "array views require vector types without padding");
+    const ParamList::Entry *entry = params.find(name);
+    if (!entry)
+      return ArrayView<V>();
+    const ParamT<T> *p = entry->param->as<T>();
     if (!p)
-      throw std::runtime_error("found param of given name, but of wrong type!");
-    if (p->getSize() != 1)
-      throw std::runtime_error("found param of given name and type, but wrong number of components!");
-    return p->paramVec[0];
+      throw std::runtime_error("found param '"+name.str()+"', but of wrong type!");
+    p->decode();
+    if (p->paramVec.size() % N)
+      throw std::runtime_error("found param '"+name.str()+"' of right type, but its number "
+                               "of values isn't a multiple of "+std::to_string(N));
+    return ArrayView<V>((const V *)p->paramVec.data(),p->paramVec.size()/N);
+  }
+
+  /*! the values of given parameter if it's stored as Vs, else (if
+    it's a plain float parameter) its floats viewed as Vs */
+  template<typename V>
+  inline ArrayView<V> getVectorArrayView(const ParamList &params, const TextView &name)
+  {
+    const ParamList::Entry *entry = params.find(name);
+    if (!entry || entry->param->storage != ParamStorageOf<V>::value)
+      return getArrayView<V,float>(params,name);
+    const ParamT<V> *p = entry->param->as<V>();
+    p->decode();
+    return ArrayView<V>(p->paramVec.data(),p->paramVec.size());
+  }
+
+  ArrayView<vec3f> Parameterized::getArray3f(const TextView &name) const
+  { return getVectorArrayView<vec3f>(param,name); }
+
+  ArrayView<vec2f> Parameterized::getArray2f(const TextView &name) const
+  { return getVectorArrayView<vec2f>(param,name); }
+
+  ArrayView<vec3i> Parameterized::getArray3i(const TextView &name) const
+  { return getArrayView<vec3i,int>(param,name); }
+
+  // ==================================================================
+  // Attributes
+  // ==================================================================
+
+  Attributes::Attributes()
+  {}
+
+  std::shared_ptr<Attributes> Attributes::derive(const std::shared_ptr<Attributes> &parent)
+  {
+    std::shared_ptr<Attributes> top = parent;
+    while (top->parent && 2*top->numDefinitions() >= top->parent->numDefinitions()) {
+      /* a copy of the layer below, with the top layer's definitions
+         (which shadow the ones below) on top */
+      std::shared_ptr<Attributes> merged = std::make_shared<Attributes>(*top->parent);
+      for (const auto &material : top->namedMaterial)
+        merged->namedMaterial[material.first] = material.second;
+      for (const auto &texture : top->namedTexture)
+        merged->namedTexture[texture.first] = texture.second;
+      top = merged;
+    }
+    std::shared_ptr<Attributes> derived = std::make_shared<Attributes>();
+    derived->parent = top;
+    return derived;
+  }
+
+  std::shared_ptr<Material> Attributes::findNamedMaterial(const std::string &name) const
+  {
+    for (const Attributes *layer = this; layer; layer = layer->parent.get()) {
+      auto it = layer->namedMaterial.find(name);
+      if (it != layer->namedMaterial.end()) return it->second;
+    }
+    return std::shared_ptr<Material>();
+  }
+
+  std::shared_ptr<Texture> Attributes::findNamedTexture(const std::string &name) const
+  {
+    for (const Attributes *layer = this; layer; layer = layer->parent.get()) {
+      auto it = layer->namedTexture.find(name);
+      if (it != layer->namedTexture.end()) return it->second;
+    }
+    return std::shared_ptr<Texture>();
   }
 
   // ==================================================================
@@ -219,13 +498,14 @@ namespace pbrt_parser {
   // ==================================================================
 
   /*! constructor */
-  Shape::Shape(const std::string &type,
+  Shape::Shape(const Symbol &type,
                std::shared_ptr<Material>   material,
                std::shared_ptr<Attributes> attributes,
-               affine3f &transform) 
-    : Node(type,transform), 
+               int transformID) 
+    : Node(type), 
       material(material),
-      attributes(attributes)
+      attributes(attributes),
+      transformID(transformID)
   {};
 
   // ==================================================================
@@ -235,10 +515,8 @@ namespace pbrt_parser {
   {
     std::stringstream ss;
     ss << "Material type='"<< type << "' {" << endl;
-    for (std::map<std::string,std::shared_ptr<Param> >::const_iterator it=param.begin(); 
-         it != param.end(); it++) {
-      ss << " - " << it->first << " : " << it->second->toString() << endl;
-    }
+    for (const ParamList::Entry &entry : param)
+      ss << " - " << entry.name << " : " << entry.param->toString() << endl;
     ss << "}" << endl;
     return ss.str();
   }
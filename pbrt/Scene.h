@@ -17,9 +17,13 @@
 #pragma once
 
 #include "pbrt/pbrt.h"
+#include "pbrt/AlignedVector.h"
+#include "pbrt/Symbol.h"
 // stl
 #include <map>
 #include <vector>
+#include <mutex>
+#include <functional>
 
 namespace pbrt_parser {
 
@@ -27,48 +31,260 @@ namespace pbrt_parser {
   struct Material;
   struct Texture;
 
+  /*! the scene's transforms, each stored only once: shapes and
+    instances refer to their transform by its index in this table,
+    so the (often very many) shapes and instances sharing the same
+    transform share a single copy, and the index can serve as a key
+    for deduplicating transforms on export */
+  struct PBRT_PARSER_INTERFACE TransformTable {
+    /*! index of the identity transform, which every table has */
+    static const int IDENTITY = 0;
+
+    TransformTable();
+
+    /*! return the index of given transform, adding it if we don't
+      have it yet. transforms count as identical if all their bits
+      are */
+    int insert(const affine3f &transform);
+
+    const affine3f &operator[](const int index) const { return transforms[index]; }
+    /*! number of unique transforms */
+    size_t size() const { return transforms.size(); }
+
+    /*! iterate over all unique transforms, in order of their indices */
+    std::vector<affine3f>::const_iterator begin() const { return transforms.begin(); }
+    std::vector<affine3f>::const_iterator end() const { return transforms.end(); }
+
+  private:
+    /*! a slot in our open-addressing hash table: index into
+      'transforms' (or -1 if empty), and that transform's hash */
+    struct Slot {
+      Slot() : hash(0), index(-1) {}
+      uint32_t hash;
+      int      index;
+    };
+    std::vector<Slot>     slots;
+    std::vector<affine3f> transforms;
+    /*! index of the transform most recently inserted (or looked up) */
+    int                   lastIndex;
+  };
+
+  /*! what a parameter's values are stored as, ie, which ParamT it
+    is; lets us get from a Param to its ParamT without RTTI */
+  typedef enum {
+    PARAM_STORAGE_FLOAT,
+    PARAM_STORAGE_VEC3F,
+    PARAM_STORAGE_VEC2F,
+    PARAM_STORAGE_INT,
+    PARAM_STORAGE_BOOL,
+    PARAM_STORAGE_STRING,
+    PARAM_STORAGE_TEXTURE
+  } ParamStorage;
+
+  template<typename T> struct ParamStorageOf;
+  template<> struct ParamStorageOf<float>       { static const ParamStorage value = PARAM_STORAGE_FLOAT; };
+  template<> struct ParamStorageOf<vec3f>       { static const ParamStorage value = PARAM_STORAGE_VEC3F; };
+  template<> struct ParamStorageOf<vec2f>       { static const ParamStorage value = PARAM_STORAGE_VEC2F; };
+  template<> struct ParamStorageOf<int>         { static const ParamStorage value = PARAM_STORAGE_INT; };
+  template<> struct ParamStorageOf<bool>        { static const ParamStorage value = PARAM_STORAGE_BOOL; };
+  template<> struct ParamStorageOf<std::string> { static const ParamStorage value = PARAM_STORAGE_STRING; };
+  template<> struct ParamStorageOf<Texture>     { static const ParamStorage value = PARAM_STORAGE_TEXTURE; };
+
+  /*! a parameter's declared type, as in "<type> <name>" */
+  typedef enum {
+    PARAM_TYPE_FLOAT,
+    PARAM_TYPE_RGB,
+    PARAM_TYPE_TEXTURE,
+    PARAM_TYPE_STRING,
+    PARAM_TYPE_INTEGER,
+    PARAM_TYPE_POINT,
+    PARAM_TYPE_COLOR,
+    PARAM_TYPE_BOOL,
+    PARAM_TYPE_NORMAL,
+    PARAM_TYPE_SPECTRUM,
+    PARAM_TYPE_POINT2,
+    PARAM_TYPE_POINT3,
+    PARAM_TYPE_POINT4,
+    PARAM_TYPE_VECTOR,
+    NUM_PARAM_TYPES
+  } ParamType;
+
+  /*! the name of given type, as used in pbrt files ("float", "rgb", ...) */
+  PBRT_PARSER_INTERFACE const char *paramTypeName(ParamType type);
+
+  template<typename T> struct ParamT;
+
   struct PBRT_PARSER_INTERFACE Param {
-    virtual std::string getType() const = 0;
+    Param(ParamStorage storage, ParamType type) : storage(storage), type(type) {}
+    virtual ~Param() {}
+
+    /*! this parameter as a ParamT<T>, or null if its values aren't
+      stored as Ts. note this doesn't decode lazily parsed values */
+    template<typename T>
+    ParamT<T> *as()
+    { return storage == ParamStorageOf<T>::value ? static_cast<ParamT<T> *>(this) : nullptr; }
+    template<typename T>
+    const ParamT<T> *as() const
+    { return storage == ParamStorageOf<T>::value ? static_cast<const ParamT<T> *>(this) : nullptr; }
+
+    std::string getType() const { return paramTypeName(type); }
     virtual size_t getSize() const = 0;
     virtual std::string toString() const = 0;
 
     /*! used during parsing, to add a newly parsed parameter value
       to the list */
-    virtual void add(const std::string &text) = 0;
+    virtual void add(const TextView &text) = 0;
+
+    const ParamStorage storage;
+    const ParamType    type;
+  };
+
+  /*! the not-yet decoded values of a lazily parsed parameter (see
+    Parser::lazyArrays): the white space separated numbers in 'text' */
+  struct PBRT_PARSER_INTERFACE LazyValues {
+    LazyValues(const TextView &text,
+               const std::shared_ptr<const void> &owner,
+               int numThreads)
+      : text(text), owner(owner), numThreads(numThreads)
+    {}
+
+    TextView       text;
+    /*! keeps 'text' alive (eg, the mapped file it points into) until
+      it got decoded */
+    std::shared_ptr<const void> owner;
+    /*! max number of threads to decode with */
+    int            numThreads;
+    std::once_flag decoded;
   };
 
+  /*! decode the numbers in given text into 'values', splitting large
+    texts across up to 'numThreads' threads (0 meaning 'all cores').
+    for vector values, throws if the number of numbers doesn't fit */
+  PBRT_PARSER_INTERFACE void decodeValues(const TextView &text, int numThreads,
+                                          AlignedVector<float> &values);
+  PBRT_PARSER_INTERFACE void decodeValues(const TextView &text, int numThreads,
+                                          AlignedVector<vec3f> &values);
+  PBRT_PARSER_INTERFACE void decodeValues(const TextView &text, int numThreads,
+                                          AlignedVector<vec2f> &values);
+  PBRT_PARSER_INTERFACE void decodeValues(const TextView &text, int numThreads,
+                                          AlignedVector<int> &values);
+  template<typename T>
+  inline void decodeValues(const TextView &text, int numThreads, AlignedVector<T> &values)
+  { throw std::runtime_error("only numeric parameters can get decoded lazily"); }
+
+  /*! a parameter whose values are Ts: float, int, bool or
+    std::string - or, for the point, normal, vector, rgb and color
+    types, vec3fs (vec2fs for point2), so vector values come as
+    ready-to-use arrays of vectors */
   template<typename T>
   struct PBRT_PARSER_INTERFACE ParamT : public Param {
-    ParamT(const std::string &type) : type(type) {};
-    virtual std::string getType() const { return type; };
-    virtual size_t getSize() const { return paramVec.size(); }
+    ParamT(ParamType type) : Param(ParamStorageOf<T>::value,type) {};
+    virtual size_t getSize() const { decode(); return paramVec.size(); }
     virtual std::string toString() const;
 
     /*! used during parsing, to add a newly parsed parameter value
       to the list */
-    virtual void add(const std::string &text);
-    //    private:
-    std::string type;
-    std::vector<T> paramVec;
+    virtual void add(const TextView &text);
+
+    /*! make sure paramVec holds the values, decoding them if they got
+      parsed lazily and nobody has accessed them yet. findParam and
+      getParam* do this, so this only needs calling when getting to
+      the parameter some other way (such as through the 'param'
+      map). thread-safe */
+    void decode() const
+    {
+      if (!lazy) return;
+      std::call_once(lazy->decoded,[this]() {
+          decodeValues(lazy->text,lazy->numThreads,const_cast<AlignedVector<T> &>(paramVec));
+          lazy->owner.reset();
+        });
+    }
+    
+    /*! the values; small arrays are stored inline, the storage of
+      larger ones is cache-line aligned */
+    AlignedVector<T> paramVec;
+    /*! if set, paramVec only becomes valid once decode()d */
+    std::shared_ptr<LazyValues> lazy;
   };
 
   struct Texture;
 
   template<>
   struct PBRT_PARSER_INTERFACE ParamT<Texture> : public Param {
-    ParamT(const std::string &type) : type(type) {};
-    virtual std::string getType() const { return type; };
+    ParamT(ParamType type) : Param(PARAM_STORAGE_TEXTURE,type) {};
     virtual size_t getSize() const { return 1; }
     virtual std::string toString() const;
     
     /*! used during parsing, to add a newly parsed parameter value
       to the list */
-    virtual void add(const std::string &text) { throw std::runtime_error("should never get called.."); }
-    //    private:
-    std::string type;
+    virtual void add(const TextView &text) { throw std::runtime_error("should never get called.."); }
+    /*! textures never get parsed lazily */
+    void decode() const {}
     std::shared_ptr<Texture> texture;
   };
 
+  /*! the parameters of a node: a flat list of (name, value) pairs,
+    searched linearly - nodes rarely have more than a dozen */
+  struct PBRT_PARSER_INTERFACE ParamList {
+    struct Entry {
+      Symbol                 name;
+      std::shared_ptr<Param> param;
+    };
+    typedef std::vector<Entry>::const_iterator const_iterator;
+
+    /*! the entry of given name, or null if there's none */
+    inline const Entry *find(const Symbol &name) const
+    {
+      for (const Entry &entry : entries)
+        if (entry.name == name)
+          return &entry;
+      return nullptr;
+    }
+    /*! same, for names that haven't been interned (and which we don't
+      want to intern just for looking them up) */
+    inline const Entry *find(const TextView &name) const
+    {
+      for (const Entry &entry : entries) {
+        const std::string &entryName = entry.name.str();
+        if (entryName.size() == name.size &&
+            memcmp(entryName.data(),name.begin,name.size) == 0)
+          return &entry;
+      }
+      return nullptr;
+    }
+    inline const Entry *find(const std::string &name) const { return find(TextView(name)); }
+    inline const Entry *find(const char *name)        const { return find(TextView(name)); }
+    /*! set the parameter of given name, replacing the one we had
+      under that name, if any */
+    void set(const Symbol &name, const std::shared_ptr<Param> &param);
+    /*! remove the parameter of given name, if we have one */
+    void erase(const TextView &name);
+
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end()   const { return entries.end(); }
+    size_t size()  const { return entries.size(); }
+    bool   empty() const { return entries.empty(); }
+    void   clear() { entries.clear(); }
+
+  private:
+    std::vector<Entry> entries;
+  };
+
+  /*! read-only view of an array of Ts stored elsewhere */
+  template<typename T>
+  struct ArrayView {
+    ArrayView() : data(nullptr), size(0) {}
+    ArrayView(const T *data, size_t size) : data(data), size(size) {}
+
+    const T *begin() const { return data; }
+    const T *end()   const { return data+size; }
+    const T &operator[](const size_t i) const { return data[i]; }
+    bool empty() const { return size == 0; }
+
+    const T *data;
+    size_t   size;
+  };
+
   /*! any class that can store (and query) parameters */
   struct PBRT_PARSER_INTERFACE Parameterized {
 
@@ -76,36 +292,71 @@ namespace pbrt_parser {
     Parameterized(Parameterized &&) = default;
     Parameterized(const Parameterized &) = default;
     
-    vec3f getParam3f(const std::string &name, const vec3f &fallBack=vec3f(0)) const;
-    float getParam1f(const std::string &name, const float fallBack=0) const;
-    int getParam1i(const std::string &name, const int fallBack=0) const;
-    bool getParamBool(const std::string &name, const bool fallBack=false) const;
-    std::string getParamString(const std::string &name) const;
-    std::shared_ptr<Texture> getParamTexture(const std::string &name) const;
+    vec3f getParam3f(const TextView &name, const vec3f &fallBack=vec3f(0)) const;
+    float getParam1f(const TextView &name, const float fallBack=0) const;
+    int getParam1i(const TextView &name, const int fallBack=0) const;
+    bool getParamBool(const TextView &name, const bool fallBack=false) const;
+    std::string getParamString(const TextView &name) const;
+    std::shared_ptr<Texture> getParamTexture(const TextView &name) const;
+
+    /*! the values of the named vector (point, normal, ...), float or
+      integer parameter, as an array of vec3fs, vec2fs or vec3is. empty if
+      there's no such parameter; throws if it's of the wrong type, or
+      its number of values doesn't fit. the view points right into the
+      parameter's (aligned) storage, so stays valid for as long as the
+      parameter does */
+    ArrayView<vec3f> getArray3f(const TextView &name) const;
+    ArrayView<vec2f> getArray2f(const TextView &name) const;
+    ArrayView<vec3i> getArray3i(const TextView &name) const;
 
     template<typename T>
-      std::shared_ptr<ParamT<T> > findParam(const std::string &name) const {
-      auto it = param.find(name);
-      if (it == param.end()) return std::shared_ptr<ParamT<T>>();
-      return std::dynamic_pointer_cast<ParamT<T> >(it->second);
+      std::shared_ptr<ParamT<T> > findParam(const TextView &name) const {
+      const ParamList::Entry *entry = param.find(name);
+      if (!entry || !entry->param->as<T>()) return std::shared_ptr<ParamT<T>>();
+      std::shared_ptr<ParamT<T> > p = std::static_pointer_cast<ParamT<T> >(entry->param);
+      p->decode();
+      return p;
     }
 
-    std::map<std::string,std::shared_ptr<Param> > param;
+    ParamList param;
   };
 
+  /*! the named materials and textures active at some point in the
+    scene. attributes are shared (by the attribute stack and all
+    shapes created while they were active), and never change once
+    shared: defining a new material or texture instead creates a new
+    layer on top of them that holds only the new definitions */
   struct PBRT_PARSER_INTERFACE Attributes {
     Attributes();
     Attributes(Attributes &&other) = default;
     Attributes(const Attributes &other) = default;
 
-    virtual std::shared_ptr<Attributes> clone() const { return std::make_shared<Attributes>(*this); }
+    /*! return a new, empty attributes layer on top of given ones.
+      layers below it that hold at least half as many definitions as
+      the layer below them get merged into that one (in a new copy -
+      layers may be shared), so each layer holds less than half of
+      the one below it: lookups visit O(log M) layers, and each of M
+      definitions gets copied O(log M) times */
+    static std::shared_ptr<Attributes> derive(const std::shared_ptr<Attributes> &parent);
+
+    /*! find the named material/texture visible in this layer or any
+      of its parents; returns null if there is none */
+    std::shared_ptr<Material> findNamedMaterial(const std::string &name) const;
+    std::shared_ptr<Texture>  findNamedTexture(const std::string &name) const;
+
+    /*! number of materials and textures defined in this layer */
+    size_t numDefinitions() const { return namedMaterial.size()+namedTexture.size(); }
+
+    /*! the layer we're on top of, if any */
+    std::shared_ptr<Attributes> parent;
 
+    /*! materials and textures defined in this layer */
     std::map<std::string,std::shared_ptr<Material> > namedMaterial;
     std::map<std::string,std::shared_ptr<Texture> >  namedTexture;
   };
 
   struct PBRT_PARSER_INTERFACE Material : public Parameterized {
-    Material(const std::string &type) : type(type) {};
+    Material(const Symbol &type) : type(type) {};
 
     /*! pretty-print this material (for debugging) */
     std::string toString() const;
@@ -116,17 +367,17 @@ namespace pbrt_parser {
       specifies the type explicitly right after the 'matierla'
       command; for the 'makenamedmaterial' it uses an implicit
       'type' parameter */
-    std::string type;
+    Symbol type;
   };
 
   struct PBRT_PARSER_INTERFACE Texture : public Parameterized {
     std::string name;
-    std::string texelType;
-    std::string mapType;
+    Symbol      texelType;
+    Symbol      mapType;
 
     Texture(const std::string &name,
-            const std::string &texelType,
-            const std::string &mapType) 
+            const Symbol &texelType,
+            const Symbol &mapType) 
       : name(name), texelType(texelType), mapType(mapType)
     {};
     // std::map<std::string,std::shared_ptr<Param> > param;
@@ -135,39 +386,33 @@ namespace pbrt_parser {
   struct PBRT_PARSER_INTERFACE Node : public Parameterized {
     Node(const Node &node) = default;
     Node(Node &&node) = default;
-    Node(const std::string &type, 
-         const affine3f &transform=affine3f(one)) 
-      : type(type), 
-      transform(transform)
+    Node(const Symbol &type) 
+      : type(type)
       {};
     virtual std::string toString() const { return type; }
 
-    const std::string type;
+    const Symbol type;
     //      std::map<std::string,std::shared_ptr<Param> > param;
-
-    /*! the active transform stack that was active when then shape
-      was defined */
-    affine3f        transform;
   };
 
   struct PBRT_PARSER_INTERFACE Camera : public Node {
-    Camera(const std::string &type) : Node(type) {};
+    Camera(const Symbol &type) : Node(type) {};
   };
 
   struct PBRT_PARSER_INTERFACE Sampler : public Node {
-    Sampler(const std::string &type) : Node(type) {};
+    Sampler(const Symbol &type) : Node(type) {};
   };
   struct PBRT_PARSER_INTERFACE Integrator : public Node {
-    Integrator(const std::string &type) : Node(type) {};
+    Integrator(const Symbol &type) : Node(type) {};
   };
   struct PBRT_PARSER_INTERFACE SurfaceIntegrator : public Node {
-    SurfaceIntegrator(const std::string &type) : Node(type) {};
+    SurfaceIntegrator(const Symbol &type) : Node(type) {};
   };
   struct PBRT_PARSER_INTERFACE VolumeIntegrator : public Node {
-    VolumeIntegrator(const std::string &type) : Node(type) {};
+    VolumeIntegrator(const Symbol &type) : Node(type) {};
   };
   struct PBRT_PARSER_INTERFACE PixelFilter : public Node {
-    PixelFilter(const std::string &type) : Node(type) {};
+    PixelFilter(const Symbol &type) : Node(type) {};
   };
 
   /*! a PBRT 'geometric shape' (a geometry in ospray terms) - ie,
@@ -175,10 +420,10 @@ namespace pbrt_parser {
     surface(s) that a ray can intersect*/
   struct PBRT_PARSER_INTERFACE Shape : public Node {
     /*! constructor */
-    Shape(const std::string &type,
+    Shape(const Symbol &type,
           std::shared_ptr<Material>   material,
           std::shared_ptr<Attributes> attributes,
-          affine3f &transform);
+          int transformID);
     Shape(const Shape &shape) = default;
     Shape(Shape &&shape) = default;
 
@@ -186,30 +431,74 @@ namespace pbrt_parser {
       one material per shape */
     std::shared_ptr<Material>   material;
     std::shared_ptr<Attributes> attributes;
+    /*! the transform that was active when the shape was defined, as
+      index into the scene's transform table (-1 for shapes passed to
+      a SceneSink, which get their transform passed along instead) */
+    int                         transformID;
+  };
+
+  /*! a 'trianglemesh' or 'plymesh' shape, whose geometry the parser
+    has already extracted from its parameters (or loaded from its ply
+    file), and validated: its P, N, uv/st and indices parameters
+    become the arrays below, and get removed from 'param' */
+  struct PBRT_PARSER_INTERFACE TriangleMesh : public Shape {
+    TriangleMesh(const Symbol &type,
+                 std::shared_ptr<Material>   material,
+                 std::shared_ptr<Attributes> attributes,
+                 int transformID)
+      : Shape(type,material,attributes,transformID)
+    {}
+
+    /*! make sure the arrays below are filled in: with the parser's
+      lazyArrays set, meshes only get built (and ply files loaded) on
+      first call of this. thread-safe */
+    void load() const
+    {
+      if (!loader) return;
+      std::call_once(loader->done,[this]() {
+          loader->load(const_cast<TriangleMesh &>(*this));
+          loader->load = nullptr;
+        });
+    }
+
+    AlignedVector<vec3f> vertex;
+    /*! either empty, or one per vertex */
+    AlignedVector<vec3f> normal;
+    /*! either empty, or one per vertex */
+    AlignedVector<vec2f> texcoord;
+    /*! vertex indices of the triangles, all of them valid */
+    AlignedVector<vec3i> index;
+
+    /*! what load() does, if the mesh hasn't been built yet */
+    struct Loader {
+      std::function<void(TriangleMesh &)> load;
+      std::once_flag                      done;
+    };
+    std::shared_ptr<Loader> loader;
   };
 
   struct PBRT_PARSER_INTERFACE Volume : public Node {
-    Volume(const std::string &type) : Node(type) {};
+    Volume(const Symbol &type) : Node(type) {};
   };
 
   struct PBRT_PARSER_INTERFACE LightSource : public Node {
-    LightSource(const std::string &type) : Node(type) {};
+    LightSource(const Symbol &type) : Node(type) {};
   };
 
   struct PBRT_PARSER_INTERFACE AreaLightSource : public Node {
-    AreaLightSource(const std::string &type) : Node(type) {};
+    AreaLightSource(const Symbol &type) : Node(type) {};
   };
 
   struct PBRT_PARSER_INTERFACE Film : public Node {
-    Film(const std::string &type) : Node(type) {};
+    Film(const Symbol &type) : Node(type) {};
   };
 
   struct PBRT_PARSER_INTERFACE Accelerator : public Node {
-    Accelerator(const std::string &type) : Node(type) {};
+    Accelerator(const Symbol &type) : Node(type) {};
   };
 
   struct PBRT_PARSER_INTERFACE Renderer : public Node {
-    Renderer(const std::string &type) : Node(type) {};
+    Renderer(const Symbol &type) : Node(type) {};
   };
 
   // a "LookAt" in the pbrt file has three vec3fs, no idea what for
@@ -230,14 +519,16 @@ namespace pbrt_parser {
     
     struct PBRT_PARSER_INTERFACE Instance {
       Instance(const std::shared_ptr<Object> &object,
-               const affine3f    &xfm)
-        : object(object), xfm(xfm)
+               int transformID)
+        : object(object), transformID(transformID)
       {}
       
       std::string toString() const;
 
       std::shared_ptr<Object> object;
-      affine3f    xfm;
+      /*! index of the instance's transform in the scene's transform
+        table */
+      int         transformID;
     };
 
     //! pretty-print scene info into a std::string 
@@ -288,6 +579,9 @@ namespace pbrt_parser {
 
     //! the 'world' scene geometry
     std::shared_ptr<Object> world;
+
+    //! all transforms that shapes and instances refer to
+    TransformTable transforms;
   };
 
 } // ::pbrt_parser
@@ -0,0 +1,63 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+/*! \file SceneSink.h streaming ('SAX style') interface to the
+    parser: rather than building a Scene, the parser hands each entity
+    to a SceneSink as soon as it is parsed */
+
+#include "pbrt/Scene.h"
+
+namespace pbrt_parser {
+
+  /*! receives the entities of a scene, in file order, as they get
+    parsed. all callbacks default to ignoring what they get.
+
+    entities come fully resolved: shapes have their material (and
+    attributes) set, and everything that has a transform gets passed
+    the one that was active when it was defined. entities passed to
+    the sink do not get added to the parser's scene (apart from the
+    scene-wide render settings such as sampler, integrator or pixel
+    filter, which still do), so unless the sink holds on to them,
+    they get released - and their parameter storage reused for the
+    entities that follow - as soon as the callback returns */
+  struct PBRT_PARSER_INTERFACE SceneSink {
+    virtual ~SceneSink() {}
+
+    virtual void onCamera(const std::shared_ptr<Camera> &camera,
+                          const affine3f &transform) {}
+    /*! a 'Material' (with empty name) or 'MakeNamedMaterial' */
+    virtual void onMaterial(const std::string &name,
+                            const std::shared_ptr<Material> &material) {}
+    virtual void onTexture(const std::shared_ptr<Texture> &texture) {}
+    virtual void onLightSource(const std::shared_ptr<LightSource> &lightSource,
+                               const affine3f &transform) {}
+    /*! a shape; its transformID is -1, as its transform gets passed
+      along here instead */
+    virtual void onShape(const std::shared_ptr<Shape> &shape,
+                         const affine3f &transform) {}
+    virtual void onVolume(const std::shared_ptr<Volume> &volume,
+                          const affine3f &transform) {}
+    /*! everything between this and the matching onObjectEnd() belongs
+      to the named object, rather than to the world */
+    virtual void onObjectBegin(const std::string &name) {}
+    virtual void onObjectEnd() {}
+    virtual void onInstance(const std::string &objectName,
+                            const affine3f &transform) {}
+  };
+
+} // ::pbrt_parser
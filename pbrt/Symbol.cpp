@@ -0,0 +1,109 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "Symbol.h"
+// std
+#include <mutex>
+#include <vector>
+#include <stdexcept>
+
+namespace pbrt_parser {
+
+  std::string *Symbol::chunks[Symbol::MAX_CHUNKS] = { nullptr };
+
+  /*! the (guarded) part of the table that interning needs: an open
+    addressing hash table of the ids, so adding a symbol doesn't cost
+    a node allocation */
+  struct SymbolTable {
+    /*! the first chunk holds the empty string, at id 0 */
+    SymbolTable() : slots(1024), numSymbols(1)
+    { Symbol::chunks[0] = new std::string[Symbol::CHUNK_SIZE]; }
+
+    /*! id 0 (which never goes into the table) marks empty slots */
+    struct Slot {
+      uint32_t hash;
+      uint32_t id;
+    };
+
+    static const std::string &string(uint32_t id)
+    { return Symbol::chunks[id >> Symbol::CHUNK_BITS][id & (Symbol::CHUNK_SIZE-1)]; }
+
+    /*! the slot that holds, or should hold, given text */
+    Slot &find(const TextView &text, uint32_t hash)
+    {
+      const size_t mask = slots.size()-1;
+      for (size_t i=hash & mask;;i=(i+1) & mask) {
+        Slot &slot = slots[i];
+        if (slot.id == 0 ||
+            (slot.hash == hash && TextView(string(slot.id)) == text))
+          return slot;
+      }
+    }
+
+    /*! double the number of slots, keeping the load below 1/2 */
+    void grow()
+    {
+      std::vector<Slot> old(2*slots.size());
+      old.swap(slots);
+      const size_t mask = slots.size()-1;
+      for (const Slot &slot : old) {
+        if (slot.id == 0) continue;
+        size_t i = slot.hash & mask;
+        while (slots[i].id != 0)
+          i = (i+1) & mask;
+        slots[i] = slot;
+      }
+    }
+
+    std::mutex        mutex;
+    std::vector<Slot> slots;
+    uint32_t          numSymbols;
+  };
+
+  uint32_t Symbol::intern(const TextView &text)
+  {
+    /* created on first use (so symbols work in other static objects'
+       constructors), and never destroyed (so they also work in their
+       destructors) */
+    static SymbolTable *table = new SymbolTable;
+    if (text.size == 0)
+      return 0;
+
+    const uint32_t hash = (uint32_t)TextView::Hash()(text);
+    std::lock_guard<std::mutex> lock(table->mutex);
+    SymbolTable::Slot *slot = &table->find(text,hash);
+    if (slot->id != 0)
+      return slot->id;
+
+    const uint32_t id = table->numSymbols;
+    if ((id >> CHUNK_BITS) >= MAX_CHUNKS)
+      throw std::runtime_error("symbol table is full");
+    std::string *&chunk = chunks[id >> CHUNK_BITS];
+    if (!chunk)
+      chunk = new std::string[CHUNK_SIZE];
+    chunk[id & (CHUNK_SIZE-1)].assign(text.begin,text.size);
+    ++table->numSymbols;
+
+    if (2*table->numSymbols > table->slots.size()) {
+      table->grow();
+      slot = &table->find(text,hash);
+    }
+    slot->hash = hash;
+    slot->id   = id;
+    return id;
+  }
+
+} // ::pbrt_parser
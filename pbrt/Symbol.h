@@ -0,0 +1,90 @@
+// ======================================================================== //
+// Copyright 2015-2018 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+/*! \file Symbol.h interned strings, for the types of a scene's
+    entities and the names of their parameters */
+
+#include "pbrt/pbrt.h"
+// std
+#include <string>
+#include <ostream>
+
+namespace pbrt_parser {
+
+  /*! a string interned in the process-wide symbol table: each
+    distinct string gets stored only once, and two symbols are equal
+    exactly if their strings are, so comparing them is a single
+    integer compare. interning is thread-safe, and symbols never get
+    released - they're meant for the small vocabulary of entity types
+    and parameter names, not for per-entity names (of textures,
+    objects, ...) or (string) parameter values, which would make the
+    table grow with every scene parsed */
+  struct PBRT_PARSER_INTERFACE Symbol {
+    /*! the empty string, which always has id 0 */
+    Symbol() : id(intern(TextView())) {}
+    Symbol(const TextView &text)    : id(intern(text)) {}
+    Symbol(const std::string &text) : id(intern(text)) {}
+    Symbol(const char *text)        : id(intern(text)) {}
+
+    /*! the interned string; stays valid (and unchanged) forever */
+    const std::string &str() const { return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE-1)]; }
+    operator const std::string &() const { return str(); }
+    const char *c_str() const { return str().c_str(); }
+    size_t      size()  const { return str().size(); }
+    bool        empty() const { return id == 0; }
+
+    bool operator==(const Symbol &other) const { return id == other.id; }
+    bool operator!=(const Symbol &other) const { return id != other.id; }
+    /*! by id - so not alphabetically, but good enough for std::map */
+    bool operator<(const Symbol &other)  const { return id < other.id; }
+
+    struct Hash {
+      inline size_t operator()(const Symbol &symbol) const { return symbol.id; }
+    };
+
+    uint32_t id;
+
+    /*! the table's strings live in chunks that never move, so looking
+      one up needs no lock */
+    static const uint32_t CHUNK_BITS = 12;
+    static const uint32_t CHUNK_SIZE = 1<<CHUNK_BITS;
+    static const uint32_t MAX_CHUNKS = 1<<16;
+
+  private:
+    friend struct SymbolTable;
+    static uint32_t intern(const TextView &text);
+    static std::string *chunks[MAX_CHUNKS];
+  };
+
+  /*! comparing with (and appending to) plain strings, without
+    interning those */
+  inline bool operator==(const Symbol &a, const char *b)        { return a.str() == b; }
+  inline bool operator!=(const Symbol &a, const char *b)        { return a.str() != b; }
+  inline bool operator==(const char *a, const Symbol &b)        { return a == b.str(); }
+  inline bool operator!=(const char *a, const Symbol &b)        { return a != b.str(); }
+  inline bool operator==(const Symbol &a, const std::string &b) { return a.str() == b; }
+  inline bool operator!=(const Symbol &a, const std::string &b) { return a.str() != b; }
+  inline bool operator==(const std::string &a, const Symbol &b) { return a == b.str(); }
+  inline bool operator!=(const std::string &a, const Symbol &b) { return a != b.str(); }
+  inline std::string operator+(const std::string &a, const Symbol &b) { return a+b.str(); }
+  inline std::string operator+(const Symbol &a, const std::string &b) { return a.str()+b; }
+  inline std::string operator+(const char *a, const Symbol &b)        { return a+b.str(); }
+  inline std::string operator+(const Symbol &a, const char *b)        { return a.str()+b; }
+  inline std::ostream &operator<<(std::ostream &o, const Symbol &symbol) { return o << symbol.str(); }
+
+} // ::pbrt_parser
@@ -113,10 +113,11 @@ namespace pbrt_parser {
 
 
     // Ref<sg::TriangleMesh> readFile(const std::string &fileName)
+    template<typename Vec3fArray, typename Vec3iArray>
     void parse(const std::string &fileName,
-               std::vector<vec3f> &pos,
-               std::vector<vec3f> &nor,
-               std::vector<vec3i> &idx)
+               Vec3fArray &pos,
+               Vec3fArray &nor,
+               Vec3iArray &idx)
     {
       int nprops;
       PlyProperty **plist;
@@ -222,11 +223,10 @@ namespace pbrt_parser {
                                                  offsetof(Vertex,other_props));
             
           /* test for necessary properties */
-          if ((!has_x) || (!has_y) || (!has_z))
-            {
-              fprintf(stderr, "Vertices don't have x, y, and z\n");
-              exit(-1);
-            }
+          if ((!has_x) || (!has_y) || (!has_z)) {
+            ply_close(ply);
+            throw std::runtime_error("ply: vertices in '"+fileName+"' don't have x, y, and z");
+          }
 	  
           vertices = num_elems;
           if (has_nx && has_ny && has_nz)
@@ -271,8 +271,8 @@ namespace pbrt_parser {
             
           /* test for necessary properties */
           if (!has_fverts) {
-            fprintf(stderr, "Faces must have vertex indices\n");
-            exit(-1);
+            ply_close(ply);
+            throw std::runtime_error("ply: faces in '"+fileName+"' don't have vertex indices");
           }
           // if (!has_face_blue)                   
           //   material = getMaterial(200,200,200);
@@ -339,8 +339,6 @@ namespace pbrt_parser {
       comments = ply_get_comments (ply, &num_comments);
       obj_info = ply_get_obj_info (ply, &num_obj_info);
         
-      ply_close (ply); 
-        
       // numFilesDone ++;
       // cout << "total done so far: " << numFilesDone << " files, " << pretty(numTrisWritten) << " tris" << endl;
       for (int i=0;i<ply->nelems;i++) {
@@ -361,6 +359,8 @@ namespace pbrt_parser {
       }
 
       free(ply->elems);
+      /* close only now, since this frees 'ply' */
+      ply_close (ply); 
         
       // Ref<sg::TriangleMesh> mesh = new sg::TriangleMesh;
       // mesh->index = idx.ptr;
@@ -380,4 +380,12 @@ namespace pbrt_parser {
     ply::parse(fileName,v,n,idx);
   }
 
+  void parsePLY(const std::string &fileName,
+                AlignedVector<vec3f> &v,
+                AlignedVector<vec3f> &n,
+                AlignedVector<vec3i> &idx)
+  {
+    ply::parse(fileName,v,n,idx);
+  }
+
 } // ::pbrt_parser
@@ -19,6 +19,9 @@
 #include "ospcommon/vec.h"
 #include "ospcommon/AffineSpace.h"
 #include "ospcommon/FileName.h"
+// std
+#include <string.h>
+#include <stdint.h>
 
 namespace pbrt_parser {
 
@@ -34,5 +37,45 @@ namespace pbrt_parser {
 #  define PBRT_PARSER_INTERFACE /* ignore on linux */
 #endif
   
+  /*! a non-owning range of chars [begin,begin+size) in some input
+    buffer */
+  struct PBRT_PARSER_INTERFACE TextView {
+    TextView() : begin(nullptr), size(0) {}
+    TextView(const char *begin, const char *end) : begin(begin), size(end-begin) {}
+    /*! views of (null-terminated, or std::) strings, so functions
+      taking names as TextViews accept both without copying */
+    TextView(const char *s) : begin(s), size(strlen(s)) {}
+    TextView(const std::string &s) : begin(s.data()), size(s.size()) {}
+
+    inline const char *end() const { return begin+size; }
+    inline std::string str() const { return std::string(begin,size); }
+    inline operator std::string() const { return str(); }
+
+    inline bool operator==(const TextView &other) const
+    { return size == other.size && (size == 0 || memcmp(begin,other.begin,size) == 0); }
+    inline bool operator!=(const TextView &other) const { return !(*this == other); }
+    inline bool operator==(const char *s) const
+    {
+      for (size_t i=0;i<size;i++)
+        if (begin[i] != s[i]) return false;
+      return s[size] == 0;
+    }
+    inline bool operator!=(const char *s) const { return !(*this == s); }
+
+    /*! (FNV-1a) hash of the viewed chars, for hash tables keyed by views */
+    struct Hash {
+      inline size_t operator()(const TextView &view) const
+      {
+        uint32_t h = 2166136261u;
+        for (size_t i=0;i<view.size;i++)
+          h = (h ^ (uint8_t)view.begin[i]) * 16777619u;
+        return h;
+      }
+    };
+
+    const char *begin;
+    size_t      size;
+  };
+
 } // ::pbrt_parser
 